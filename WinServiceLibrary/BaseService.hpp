@@ -1,24 +1,61 @@
 #ifndef BASE_SERVICE_HPP_
 #define BASE_SERVICE_HPP_
 
+#include "ComponentSupervisor.hpp"
+#include "ServiceCommandChannel.hpp"
 #include "ServiceExecutionTypeException.hpp"
+#include "ServiceHeartbeat.hpp"
+#include "ServicePlacement.hpp"
+#include "ServiceShard.hpp"
+#include "ServiceStateMachine.hpp"
+#include "ServiceTimeline.hpp"
+#include "ServiceTrace.hpp"
 #include "WinApiLastErrorException.hpp"
 
 #include <Windows.h>
 #include <assert.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
 namespace WinServiceLib
 {
+	class ServiceStateStress;
+	class ServiceTraceReplayer;
+
 	/*
 	* Base service class - using singletone design to run project as service on the windows OS.
 	*/
 	class BaseService
 	{
 	private:
+		friend class ServiceStateStress;
+		friend class ServiceTraceReplayer;
+
 		static BaseService*		_instance;		//The singleton instance
-		const char*				_name;			//The name of the service
+		const char*				_name;			//The name of the service (of the instance, for a sharded service)
+		std::string				_instanceName;	//Storage of the instance name of a sharded service
+		ShardInfo				_shard;			//The instance of the service group run by the process
 		SERVICE_STATUS			_status;		//The status of the service
 		SERVICE_STATUS_HANDLE	_statusHandle; 	//The service status handle
+		ServiceHeartbeat		_heartbeat;		//The shared-memory liveness/readiness slot
+		ServiceTraceRecorder	_trace;			//Records control codes and status transitions
+		ServiceStateMachine		_machine;		//The life cycle state
+		PlacementPolicy			_placement;		//The placement policy stored at install time
+		ServiceCommandServer	_channel;		//Shared-memory command channel, when enabled
+		ComponentSupervisor		_supervisor;	//Restarts the internal components of the service
+		size_t					_channelSlots;	//Maximum number of command channel clients, 0 - disabled
+		size_t					_channelRing;	//Size of the command channel rings in bytes
+		std::string				_timelinePath;	//Where the timeline is exported, empty - timeline disabled
+		long long				_dispatchBegin;	//When run started connecting to the SCM, on the timeline clock
+		std::atomic<bool>		_stopRequested;	//A stop arrived while the service was starting
+		bool					_isolated;		//Replayed - start skips the heartbeat, placement and command channel
+		std::mutex				_statusLock;	//Serializes status reports
+		std::mutex				_startLock;		//Guards the wait for the start to complete
+		std::condition_variable	_startCompleted;	//Signaled when the service leaves SERVICE_START_PENDING
 
 		/*
 		* Method: main
@@ -29,9 +66,13 @@ namespace WinServiceLib
 		static void WINAPI main(unsigned long argc, char** argv)
 		{
 			assert(_instance);
+			ServiceTimeline::record("dispatcher connect", "lifecycle", _instance->_dispatchBegin, ServiceTimeline::now());
 
 			// Register the handler function for the service
-			_instance->_statusHandle = RegisterServiceCtrlHandler(_instance->_name, handleControl);
+			{
+				TimelineSpan span("RegisterServiceCtrlHandler", "lifecycle");
+				_instance->_statusHandle = RegisterServiceCtrlHandler(_instance->_name, handleControl);
+			}
 			if (_instance->_statusHandle != 0)
 			{
 				// Start the service.
@@ -49,50 +90,257 @@ namespace WinServiceLib
 		*/
 		static void WINAPI handleControl(unsigned long control)
 		{
+			_instance->control(control);
+		}
+
+		/*
+		* Method: control
+		* Task: Dispatch a control code to the matching life cycle method
+		* Args: unsigned long control - control code sent
+		* Returns: None
+		*/
+		void control(unsigned long control)
+		{
+			_trace.record(TraceEventType::CONTROL, control);
+
 			switch (control)
 			{
-			case SERVICE_CONTROL_STOP:			_instance->stop();		break;
-			case SERVICE_CONTROL_PAUSE:			_instance->pause();		break;
-			case SERVICE_CONTROL_CONTINUE:		_instance->resume();	break;
-			case SERVICE_CONTROL_SHUTDOWN:		_instance->shutdown();	break;
-			default:													break;
+			case SERVICE_CONTROL_STOP:			stop();		break;
+			case SERVICE_CONTROL_PAUSE:			pause();	break;
+			case SERVICE_CONTROL_CONTINUE:		resume();	break;
+			case SERVICE_CONTROL_SHUTDOWN:		shutdown();	break;
+			case SERVICE_CONTROL_EXPORT_TIMELINE:	exportTimeline();	break;
+			default:
+				// Custom control codes sent with ServiceManager::sendControl or by a RemoteServiceController
+				if (control >= 128 && control <= 255)
+				{
+					try
+					{
+						onCustomControl(control);
+					}
+					catch (...)
+					{
+					}
+				}
+				break;
 			}
 		}
 
-	protected: 
 		/*
-		* Method: setStatus
-		* Task: Set the service status and report the status to the SCM.
-		* Args: currentState - the state of the service
-		*		exitCode - error code to report
+		* Method: report
+		* Task: Report the current state of the state machine to the SCM.
+		*		Reports are serialized and always carry the newest state, so a late report never rolls back the state seen by the SCM.
+		* Args: exitCode - error code to report
 		*		waitHint - estimated time for pending operation, in milliseconds
 		* Return: None
 		*/
-		void setStatus(unsigned long currentState, unsigned long exitCode = NO_ERROR, unsigned long waitHint = 0)
+		void report(unsigned long exitCode = NO_ERROR, unsigned long waitHint = 0)
 		{
 			static unsigned long checkPoint = 1;
 
+			std::lock_guard<std::mutex> guard(_statusLock);
+			unsigned long currentState = _machine.state();
+
 			// Fill in the SERVICE_STATUS structure of the service.
 			_status.dwCurrentState = currentState;
 			_status.dwWin32ExitCode = exitCode;
 			_status.dwWaitHint = waitHint;
 			_status.dwCheckPoint = ((currentState == SERVICE_RUNNING) || (currentState == SERVICE_STOPPED)) ? 0 : checkPoint++;
 
+			_trace.record(TraceEventType::STATUS, currentState);
+
 			// Report the status of the service to the SCM.
 			SetServiceStatus(_statusHandle, &_status);
 		}
 
+		/* Wake an escalation waiting for the service to leave SERVICE_START_PENDING */
+		void notifyStartCompleted()
+		{
+			{
+				std::lock_guard<std::mutex> guard(_startLock);
+			}
+			_startCompleted.notify_all();
+		}
+
+		/*
+		* Method: stopAfterFailure
+		* Task: Move a service whose initialization failed from start pending to stopped. No other operation runs
+		*		while the service is start pending, a stop requested meanwhile is dropped.
+		* Args: exitCode - error code to report
+		* Return: None
+		*/
+		void stopAfterFailure(unsigned long exitCode)
+		{
+			_machine.transition(SERVICE_START_PENDING, SERVICE_STOPPED);
+			_stopRequested = false;
+			notifyStartCompleted();
+
+			_supervisor.stop();
+			_channel.close();
+			report(exitCode);
+		}
+
+		/*
+		* Method: escalate
+		* Task: Stop the service with an error after its components entered a crash loop, so the recovery
+		*		actions of the SCM (restart the service) apply - the SCM runs them on a stop with an error only if
+		*		the service was configured with ServiceManager::setServiceRecovery. Runs on the supervisor thread,
+		*		the components are already stopped.
+		* Args: exitCode - error code to report
+		* Return: None
+		*/
+		void escalate(unsigned long exitCode)
+		{
+			unsigned long original_state;
+
+			// Components fail fast while the service is still starting - escalate once the start completed or failed.
+			{
+				std::unique_lock<std::mutex> guard(_startLock);
+				_startCompleted.wait(guard, [this]() { return _machine.state() != SERVICE_START_PENDING; });
+			}
+
+			if (!_machine.begin({ SERVICE_RUNNING, SERVICE_PAUSED }, SERVICE_STOP_PENDING, original_state))
+			{
+				return;
+			}
+
+			report();
+			_heartbeat.setReady(false);
+
+			try
+			{
+				onStop();
+			}
+			catch (...)
+			{
+			}
+
+			_channel.close();
+			exportTimeline();
+			_machine.transition(SERVICE_STOP_PENDING, SERVICE_STOPPED);
+			report(exitCode);
+		}
+
+	protected: 
+		/*
+		* Method: heartbeat
+		* Task: Access the shared-memory heartbeat slot of the service. It's opened when the service starts.
+		*		Worker threads call beat() periodically, setReady() and setHealth() publish readiness and
+		*		an application defined health word. All updates are lock-free.
+		* Args: None
+		* Return: The heartbeat of the service
+		*/
+		ServiceHeartbeat& heartbeat()
+		{
+			return _heartbeat;
+		}
+
+		/*
+		* Method: createThread
+		* Task: Create a thread of the service that follows the placement policy of its role.
+		*		A thread whose placement can't be applied still runs, with the process placement.
+		* Args: role - The role of the thread, as named in the placement policy
+		*		function - The function the thread runs
+		* Return: The created thread
+		*/
+		template <typename Function>
+		std::thread createThread(const std::string& role, Function function)
+		{
+			return std::thread([this, role, function]() mutable
+			{
+				applyThreadPlacement(role);
+				function();
+			});
+		}
+
+		/*
+		* Method: supervisor
+		* Task: Access the supervisor of the internal components of the service. Components added in onStart
+		*		start when onStart returns, each on a thread placed by its name as role. A failed component is
+		*		restarted in-process while the others keep serving; a crash loop stops the service with
+		*		ERROR_PROCESS_ABORTED, so the recovery actions of the SCM apply (see ServiceManager::setServiceRecovery).
+		*		The metrics of the supervisor keep the component that was escalated and its error.
+		* Args: None
+		* Return: The supervisor of the service
+		*/
+		ComponentSupervisor& supervisor()
+		{
+			return _supervisor;
+		}
+
+		/*
+		* Method: applyThreadPlacement
+		* Task: Apply the placement policy of a role to the calling thread - for threads not created with createThread
+		* Args: role - The role of the thread, as named in the placement policy
+		* Return: true if the placement was applied (or the role has none)
+		*/
+		bool applyThreadPlacement(const std::string& role)
+		{
+			try
+			{
+				ServicePlacement::applyThread(_placement, role);
+			}
+			catch (const WinApiLastErrorException&)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		/*
+		* Method: setStatus
+		* Task: Report progress of a long pending operation to the SCM - the current pending state again,
+		*		with the next checkpoint and a new wait hint. Only start, stop, pause and resume move the
+		*		service to another state, so a callback can't skip the steps around it.
+		* Args: currentState - the state of the service, must be the current pending state
+		*		exitCode - error code to report
+		*		waitHint - estimated time for the rest of the pending operation, in milliseconds
+		* Return: true if the status was reported, false if the service is not in currentState or it's not pending
+		*/
+		bool setStatus(unsigned long currentState, unsigned long exitCode = NO_ERROR, unsigned long waitHint = 0)
+		{
+			if (!ServiceStateMachine::isPending(currentState) || _machine.state() != currentState)
+			{
+				return false;
+			}
+
+			report(exitCode, waitHint);
+			return true;
+		}
+
 		/*
 		* Method: onStart
-		* Task: Pure virtual method - When implemented in a derived class, executes when a Start command is
+		* Task: virtual method - When implemented in a derived class, executes when a Start command is
 		*		sent to the service by the SCM or when the operating system starts (for a service that starts automatically).
 		*		The function starts the service. It calls the OnStart virtual function in which you can specify the actions
-		*		to take when the service starts.
+		*		to take when the service starts. Sharded services read their instance with getShard().
 		* Args: command line arguments
 		* Return: None.
 		*/
 		virtual void onStart(unsigned long argc, char** argv) = 0;
 
+		/*
+		* Method: onCommand
+		* Task: virtual method - When implemented in a derived class, executes when a client of the command channel
+		*		sends a request (see enableCommandChannel). Runs on the channel thread, one request at a time.
+		*		The request payload is valid until the method returns; write the reply with reply.send or,
+		*		zero copy, with reply.reserve and reply.commit. Requests left unanswered get an empty reply.
+		* Args: request - The request
+		*		reply - Writes the reply to the requesting client
+		* Return: None.
+		*/
+		virtual void onCommand(const CommandMessage&, CommandReply&) {}
+
+		/*
+		* Method: onCustomControl
+		* Task: virtual method - When implemented in a derived class, executes when a custom control code (128-255)
+		*		is sent to the service. Runs on the SCM handler thread, so it must return quickly.
+		*		SERVICE_CONTROL_EXPORT_TIMELINE (200) is handled by the library and not forwarded.
+		* Args: control - The custom control code
+		* Return: None.
+		*/
+		virtual void onCustomControl(unsigned long) {}
+
 		/*
 		* Method: onStop
 		* Task: virtual method - When implemented in a derived class, executes when a Stop command is
@@ -153,11 +401,19 @@ namespace WinServiceLib
 		* Returns: Instance of BaseService
 		*/
 		BaseService(const char* name, bool canStop = true, bool canShutdown = true, bool canPauseContinue = false)
-			: _name(name), _statusHandle(NULL)
+			: _name(name), _statusHandle(NULL), _channelSlots(0), _channelRing(0), _dispatchBegin(0), _stopRequested(false), _isolated(false)
 		{
 			assert(name);
 			assert(name[0]); //Not an empty string
 
+			//An instance of a service group runs under the name of the instance
+			_shard = ServiceShard::current();
+			if (_shard.isSharded())
+			{
+				_instanceName = ServiceShard::instanceName(name, _shard.index);
+				_name = _instanceName.c_str();
+			}
+
 			//Commands accepted by the service
 			DWORD dwControlsAccepted = 0;
 			if (canStop)
@@ -202,6 +458,7 @@ namespace WinServiceLib
 		static void run(BaseService* service)
 		{
 			_instance = service;
+			_instance->_dispatchBegin = ServiceTimeline::now();
 			char* serviceName = const_cast<char*>(_instance->getName());
 
 			SERVICE_TABLE_ENTRY serviceTable[] =
@@ -233,128 +490,370 @@ namespace WinServiceLib
 			return _name; 
 		}
 
+		/*
+		* Method: enableTrace
+		* Task: Start recording every control code and status transition with high-resolution timestamps.
+		*		Enable before run() to capture the whole life cycle; replay the trace with ServiceTraceReplayer.
+		* Args: capacity - Number of events to reserve room for
+		* Return: None
+		*/
+		void enableTrace(size_t capacity = 4096)
+		{
+			_trace.enable(capacity);
+		}
+
+		/* Stop recording, the recorded events are kept */
+		void disableTrace()
+		{
+			_trace.disable();
+		}
+
+		/* Return a copy of the recorded events */
+		std::vector<TraceEvent> getTrace()
+		{
+			return _trace.events();
+		}
+
+		/* Write the recorded events to a binary trace file */
+		void saveTrace(const std::string& path)
+		{
+			_trace.save(path);
+		}
+
+		/*
+		* Method: enableTimeline
+		* Task: Start recording the life cycle spans of the library and the TimelineSpan scopes of the service.
+		*		Enable before run() to capture the whole startup. The timeline is exported to path before the service
+		*		reports it stopped, and on demand with ServiceManager::requestTimelineExport.
+		* Args: path - The Chrome trace-event JSON file to export to
+		*		capacity - Maximum number of spans kept per thread
+		* Return: None
+		*/
+		void enableTimeline(const std::string& path, size_t capacity = 16384)
+		{
+			_timelinePath = path;
+			ServiceTimeline::enable(capacity);
+		}
+
+		/*
+		* Method: exportTimeline
+		* Task: Export the spans recorded so far to the path given to enableTimeline
+		* Args: None
+		* Return: false if the timeline is disabled or couldn't be written
+		*/
+		bool exportTimeline()
+		{
+			if (_timelinePath.empty())
+			{
+				return false;
+			}
+
+			try
+			{
+				ServiceTimeline::exportChrome(_timelinePath);
+			}
+			catch (const std::exception&)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		/*
+		* Method: enableCommandChannel
+		* Task: Expose a typed request/response channel over shared-memory rings when the service starts.
+		*		Controllers connect with ServiceCommandClient, requests are handled by onCommand.
+		* Args: slots - Maximum number of connected clients
+		*		ring_size - Size of the request and response ring of every client in bytes
+		* Return: None
+		*/
+		void enableCommandChannel(size_t slots = 8, size_t ring_size = 1 << 20)
+		{
+			_channelSlots = slots;
+			_channelRing = ring_size;
+		}
+
+		/* Return the instance of the service group run by the process, count is 0 if the service is not sharded */
+		const ShardInfo& getShard() const
+		{
+			return _shard;
+		}
+
+		/* Return the placement policy applied when the service started */
+		const PlacementPolicy& getPlacement() const
+		{
+			return _placement;
+		}
+
+		/* Return the current life cycle state (SERVICE_STOPPED, SERVICE_RUNNING...) */
+		unsigned long getState() const
+		{
+			return _machine.state();
+		}
+
 		/*
 		* Method groups: Control service life cycle
-		* Task: Control all service operations sent by SCM - start, pause, resume, shutdown, stop
+		* Task: Control all service operations sent by SCM - start, pause, resume, shutdown, stop.
+		*		Every operation is a transition of the state machine: it's rejected (returns false) unless the
+		*		service is in a state that accepts it, and the callbacks of concurrent operations never overlap.
+		*		The service stays start pending until onStart returned and its components started; a stop arriving
+		*		meanwhile is deferred until the start completes.
 		*/
-		void start(unsigned long argc, char** argv)
+		bool start(unsigned long argc, char** argv)
 		{
+			unsigned long previous;
+			TimelineSpan span("start", "lifecycle");
+
+			_trace.record(TraceEventType::START, argc);
+
+			// Tell SCM that the service is starting.
+			if (!_machine.begin({ SERVICE_STOPPED }, SERVICE_START_PENDING, previous))
+			{
+				return false;
+			}
+			report();
+
+			// Expose the heartbeat slot, the service can run without it.
+			// An isolated (replayed) service shares no state with an installed service of the same name.
+			try
+			{
+				if (!_isolated)
+				{
+					TimelineSpan open_span("open heartbeat", "lifecycle");
+					_heartbeat.open(_name);
+				}
+			}
+			catch (const WinApiLastErrorException&)
+			{
+			}
+
 			try
 			{
-				// Tell SCM that the service is starting.
-				setStatus(SERVICE_START_PENDING);
+				// Apply the placement policy stored at install time, the SCM thread calling start has the "main" role.
+				if (!_isolated && ServicePlacement::load(_name, _placement))
+				{
+					TimelineSpan placement_span("apply placement", "lifecycle");
+					ServicePlacement::applyProcess(_placement);
+					ServicePlacement::applyThread(_placement, "main");
+				}
 
-				// Tell SCM that the service is started.
-				setStatus(SERVICE_RUNNING);
+				// Serve the command channel on its own thread, placed by the "channel" role.
+				if (_channelSlots && !_isolated)
+				{
+					TimelineSpan channel_span("open command channel", "lifecycle");
+					_channel.open(_name, _channelSlots, _channelRing, [this](const CommandMessage& request, CommandReply& reply)
+					{
+						onCommand(request, reply);
+					});
+					_channel.start([this](std::function<void()> function) { return createThread("channel", function); });
+				}
 
 				// Perform service-specific initialization.
+				TimelineSpan start_span("onStart", "lifecycle");
 				onStart(argc, argv);
+
+				// Start the components registered by onStart under supervision.
+				if (_supervisor.size())
+				{
+					// The escalated component and its error are kept in the metrics of the supervisor.
+					_supervisor.start([this](const std::string& role, std::function<void()> function) { return createThread(role, function); },
+						[this](const std::string&, const std::string&) { escalate(ERROR_PROCESS_ABORTED); });
+				}
 			}
 			catch (DWORD error)
 			{
 				// Set the service status to be stopped.
-				setStatus(SERVICE_STOPPED, error);
+				stopAfterFailure(error);
 
 				throw std::exception("Service start error");
 			}
+			catch (const WinApiLastErrorException& ex)
+			{
+				// Placement and command channel failures carry their error code.
+				stopAfterFailure(ex.lastErrorCode);
+
+				throw std::exception("Service failed to start");
+			}
 			catch (...)
 			{
 				// Set the service status to be stopped.
-				setStatus(SERVICE_STOPPED);
+				stopAfterFailure(NO_ERROR);
 
 				throw std::exception("Service failed to start");
 			}
+
+			// Tell SCM that the service is started.
+			if (_machine.transition(SERVICE_START_PENDING, SERVICE_RUNNING))
+			{
+				report();
+			}
+			notifyStartCompleted();
+
+			// A stop requested while starting is executed now.
+			if (_stopRequested.exchange(false))
+			{
+				stop();
+			}
+
+			return true;
 		}
-		void stop()
+		bool stop()
 		{
-			unsigned long original_state = _status.dwCurrentState;
+			unsigned long original_state;
+			TimelineSpan span("stop", "lifecycle");
 
-			try
+			if (!_machine.begin({ SERVICE_RUNNING, SERVICE_PAUSED }, SERVICE_STOP_PENDING, original_state))
 			{
-				// Tell SCM that the service is stopping.
-				setStatus(SERVICE_STOP_PENDING);
+				if (_machine.state() != SERVICE_START_PENDING)
+				{
+					return false;
+				}
 
-				// Perform service-specific stop operations.
-				onStop();
+				// Defer the stop until the start completes. If the start completed meanwhile, whoever takes the request executes it.
+				_stopRequested = true;
+				if (_machine.state() == SERVICE_START_PENDING || !_stopRequested.exchange(false))
+				{
+					return true;
+				}
 
-				// Tell SCM that the service is stopped.
-				setStatus(SERVICE_STOPPED);
+				if (!_machine.begin({ SERVICE_RUNNING, SERVICE_PAUSED }, SERVICE_STOP_PENDING, original_state))
+				{
+					return false;
+				}
 			}
-			catch (DWORD)
+
+			unsigned long exit_code = NO_ERROR;
+
+			try
 			{
-				// Set the orginal service status.
-				setStatus(original_state);
+				// Tell SCM that the service is stopping.
+				report();
+				_heartbeat.setReady(false);
+
+				// Stop the components, then perform service-specific stop operations.
+				_supervisor.stop();
+				{
+					TimelineSpan stop_span("onStop", "lifecycle");
+					onStop();
+				}
 			}
 			catch (...)
 			{
-				// Set the orginal service status.
-				setStatus(original_state);
+				// The components are already stopped - finish stopping and report the failure.
+				exit_code = ERROR_EXCEPTION_IN_SERVICE;
 			}
+
+			_channel.close();
+
+			// Tell SCM that the service is stopped.
+			exportTimeline();
+			_machine.transition(SERVICE_STOP_PENDING, SERVICE_STOPPED);
+			report(exit_code);
+
+			return true;
 		}
-		void pause()
+		bool pause()
 		{
+			unsigned long previous;
+
+			if (!_machine.begin({ SERVICE_RUNNING }, SERVICE_PAUSE_PENDING, previous))
+			{
+				return false;
+			}
+
 			try
 			{
 				// Tell SCM that the service is pausing.
-				setStatus(SERVICE_PAUSE_PENDING);
+				report();
 
 				// Perform service-specific pause operations.
-				onPause();
+				{
+					TimelineSpan pause_span("onPause", "lifecycle");
+					onPause();
+				}
 
 				// Tell SCM that the service is paused.
-				setStatus(SERVICE_PAUSED);
-			}
-			catch (DWORD)
-			{
-				// Tell SCM that the service is still running.
-				setStatus(SERVICE_RUNNING);
+				_machine.transition(SERVICE_PAUSE_PENDING, SERVICE_PAUSED);
+				report();
 			}
 			catch (...)
 			{
 				// Tell SCM that the service is still running.
-				setStatus(SERVICE_RUNNING);
+				_machine.transition(SERVICE_PAUSE_PENDING, SERVICE_RUNNING);
+				report();
 			}
+
+			return true;
 		}
-		void resume()
+		bool resume()
 		{
+			unsigned long previous;
+
+			if (!_machine.begin({ SERVICE_PAUSED }, SERVICE_CONTINUE_PENDING, previous))
+			{
+				return false;
+			}
+
 			try
 			{
 				// Tell SCM that the service is resuming.
-				setStatus(SERVICE_CONTINUE_PENDING);
+				report();
 
 				// Perform service-specific continue operations.
-				onResume();
+				{
+					TimelineSpan resume_span("onResume", "lifecycle");
+					onResume();
+				}
 
 				// Tell SCM that the service is running.
-				setStatus(SERVICE_RUNNING);
-			}
-			catch (DWORD)
-			{
-				// Tell SCM that the service is still paused.
-				setStatus(SERVICE_PAUSED);
+				_machine.transition(SERVICE_CONTINUE_PENDING, SERVICE_RUNNING);
+				report();
 			}
 			catch (...)
 			{
 				// Tell SCM that the service is still paused.
-				setStatus(SERVICE_PAUSED);
+				_machine.transition(SERVICE_CONTINUE_PENDING, SERVICE_PAUSED);
+				report();
 			}
+
+			return true;
 		}
-		void shutdown()
+		bool shutdown()
 		{
-			try
-			{
-				// Perform service-specific shutdown operations.
-				onShutdown();
+			unsigned long original_state;
 
-				// Tell SCM that the service is stopped.
-				setStatus(SERVICE_STOPPED);
+			if (!_machine.begin({ SERVICE_RUNNING, SERVICE_PAUSED }, SERVICE_STOP_PENDING, original_state))
+			{
+				return false;
 			}
-			catch (DWORD)
+
+			unsigned long exit_code = NO_ERROR;
+
+			try
 			{
+				_heartbeat.setReady(false);
+
+				// Stop the components, then perform service-specific shutdown operations.
+				_supervisor.stop();
+				{
+					TimelineSpan shutdown_span("onShutdown", "lifecycle");
+					onShutdown();
+				}
 			}
 			catch (...)
 			{
+				// The system is going down and the components are already stopped - finish stopping and report the failure.
+				exit_code = ERROR_EXCEPTION_IN_SERVICE;
 			}
+
+			_channel.close();
+
+			// Tell SCM that the service is stopped.
+			exportTimeline();
+			_machine.transition(SERVICE_STOP_PENDING, SERVICE_STOPPED);
+			report(exit_code);
+
+			return true;
 		}
 	};
 
@@ -0,0 +1,285 @@
+#ifndef COMMAND_CHANNEL_BENCHMARK_HPP_
+#define COMMAND_CHANNEL_BENCHMARK_HPP_
+
+#include "RemoteServiceProtocol.hpp"	//WinSock2 before Windows.h
+#include "ServiceCommandClient.hpp"
+#include "StressHarness.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Measured performance of one transport
+	*/
+	struct TransportBenchmark
+	{
+		LatencyPercentiles	roundTrip;			//Latency of a single request and its reply, in microseconds
+		double				batchedPerSecond;	//Requests per second answered when sent in batches
+	};
+
+	/*
+	* Result of a command channel benchmark run
+	*/
+	struct ChannelBenchmarkReport
+	{
+		size_t					payload;		//Size of every request and reply in bytes
+		size_t					iterations;		//Round trips measured, and requests sent in batches, per transport
+		size_t					batch;			//Requests sent before the replies are read
+		TransportBenchmark		channel;		//The shared-memory command channel - call(), post()/flush()
+		TransportBenchmark		socket;			//Baseline - a TCP connection over the loopback with Nagle disabled
+	};
+
+	/*
+	* Measures the command channel against the loopback socket a controller would otherwise use.
+	* Both transports talk to an echo server in the calling process, on its own thread: the channel through
+	* ServiceCommandServer as a service would run it, the socket through a blocking accept/recv/send loop.
+	* The channel mapping is created in the Global namespace, so run the benchmark elevated (or as a service).
+	*/
+	class CommandChannelBenchmark
+	{
+	private:
+		/* Maximum time to wait for a reply before the run is abandoned, in milliseconds */
+		static const unsigned long REPLY_TIMEOUT = 5000;
+
+		/* Send a whole buffer on a connected socket */
+		static void sendAll(SOCKET socket, const char* data, size_t length)
+		{
+			while (length)
+			{
+				int sent = send(socket, data, static_cast<int>(length), 0);
+				if (sent == SOCKET_ERROR)
+				{
+					throw WinApiLastErrorException("send failed", WSAGetLastError());
+				}
+				data += sent;
+				length -= static_cast<size_t>(sent);
+			}
+		}
+
+		/* Receive a whole buffer from a connected socket, returns false if the peer closed the connection */
+		static bool receiveAll(SOCKET socket, char* data, size_t length)
+		{
+			while (length)
+			{
+				int received = recv(socket, data, static_cast<int>(length), 0);
+				if (received == SOCKET_ERROR)
+				{
+					throw WinApiLastErrorException("recv failed", WSAGetLastError());
+				}
+				if (received == 0)
+				{
+					return false;
+				}
+				data += received;
+				length -= static_cast<size_t>(received);
+			}
+			return true;
+		}
+
+		/* Return the elapsed time since begin in microseconds */
+		static double elapsed(std::chrono::steady_clock::time_point begin)
+		{
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+		}
+
+		/*
+		* Method: measureChannel
+		* Task: Measure call() round trips and post()/flush() batches against an echoing ServiceCommandServer
+		* Args: channel_name - Name the channel is created under
+		*		payload, iterations, batch - see run
+		* Return: The measured performance
+		*/
+		static TransportBenchmark measureChannel(const char* channel_name, size_t payload, size_t iterations, size_t batch)
+		{
+			TransportBenchmark result = {};
+			std::vector<char> request(payload, 'r');
+			std::vector<char> response;
+			std::vector<double> samples(iterations);
+
+			//A whole batch of requests fits the request ring
+			size_t ring_size = std::max<size_t>(4096, 2 * batch * CommandChannel::align(sizeof(CommandChannel::RecordHeader) + payload));
+
+			ServiceCommandServer server;
+			server.open(channel_name, 1, ring_size, [](const CommandMessage& message, CommandReply& reply)
+			{
+				reply.send(message.type, message.payload, message.length);
+			});
+			server.start([](std::function<void()> function) { return std::thread(function); });
+
+			ServiceCommandClient client(channel_name);
+
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				auto begin = std::chrono::steady_clock::now();
+				client.call(1, request.data(), payload, response, REPLY_TIMEOUT);
+				samples[i] = elapsed(begin);
+			}
+			result.roundTrip = LatencyPercentiles::of(samples);
+
+			auto begin = std::chrono::steady_clock::now();
+			for (size_t sent = 0; sent < iterations; sent += batch)
+			{
+				size_t count = std::min(batch, iterations - sent);
+				for (size_t i = 0; i < count; ++i)
+				{
+					client.post(1, request.data(), payload, REPLY_TIMEOUT);
+				}
+				client.flush();
+
+				CommandMessage reply;
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (!client.receive(reply, REPLY_TIMEOUT))
+					{
+						throw WinApiLastErrorException("Command timed out", ERROR_TIMEOUT);
+					}
+				}
+				client.release();
+			}
+			result.batchedPerSecond = static_cast<double>(iterations) * 1000000.0 / elapsed(begin);
+
+			server.close();
+			return result;
+		}
+
+		/*
+		* Method: measureSocket
+		* Task: Measure request/reply round trips and batches over a loopback TCP connection to an echo thread
+		* Args: payload, iterations, batch - see run
+		* Return: The measured performance
+		*/
+		static TransportBenchmark measureSocket(size_t payload, size_t iterations, size_t batch)
+		{
+			TransportBenchmark result = {};
+			std::vector<char> request(payload * batch, 'r');
+			std::vector<char> response(payload * batch);
+			std::vector<double> samples(iterations);
+			BOOL no_delay = TRUE;
+
+			RemoteProtocol::WinSockSession session;
+			SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			SOCKET client = INVALID_SOCKET;
+			SOCKET served = INVALID_SOCKET;
+			std::thread echo;
+
+			try
+			{
+				sockaddr_in address = {};
+				int length = sizeof(address);
+				address.sin_family = AF_INET;
+				address.sin_port = 0;
+				inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+				if (listener == INVALID_SOCKET ||
+					bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+					listen(listener, 1) == SOCKET_ERROR ||
+					getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) == SOCKET_ERROR)
+				{
+					throw WinApiLastErrorException("Benchmark listener failed", WSAGetLastError());
+				}
+
+				if ((client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET ||
+					connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+					(served = accept(listener, NULL, NULL)) == INVALID_SOCKET)
+				{
+					throw WinApiLastErrorException("Benchmark connect failed", WSAGetLastError());
+				}
+
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+				setsockopt(served, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+
+				//Echo every request until the client disconnects
+				echo = std::thread([served, payload]()
+				{
+					std::vector<char> message(payload);
+					try
+					{
+						while (receiveAll(served, message.data(), payload))
+						{
+							sendAll(served, message.data(), payload);
+						}
+					}
+					catch (const WinApiLastErrorException&)
+					{
+					}
+				});
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					auto begin = std::chrono::steady_clock::now();
+					sendAll(client, request.data(), payload);
+					receiveAll(client, response.data(), payload);
+					samples[i] = elapsed(begin);
+				}
+				result.roundTrip = LatencyPercentiles::of(samples);
+
+				auto begin = std::chrono::steady_clock::now();
+				for (size_t sent = 0; sent < iterations; sent += batch)
+				{
+					size_t count = std::min(batch, iterations - sent);
+					sendAll(client, request.data(), count * payload);
+					receiveAll(client, response.data(), count * payload);
+				}
+				result.batchedPerSecond = static_cast<double>(iterations) * 1000000.0 / elapsed(begin);
+			}
+			catch (const WinApiLastErrorException&)
+			{
+				if (client != INVALID_SOCKET)
+				{
+					closesocket(client);
+				}
+				if (echo.joinable())
+				{
+					echo.join();
+				}
+				if (served != INVALID_SOCKET)
+				{
+					closesocket(served);
+				}
+				closesocket(listener);
+				throw;
+			}
+
+			closesocket(client);
+			echo.join();
+			closesocket(served);
+			closesocket(listener);
+			return result;
+		}
+
+	public:
+		/* Static class - deleted constructor & destructor */
+		CommandChannelBenchmark() = delete;
+		~CommandChannelBenchmark() = delete;
+
+		/*
+		* Method: run
+		* Task: Measure round trip latency and batched throughput of the command channel and of a loopback socket
+		* Args: payload - Size of every request and reply in bytes
+		*		iterations - Round trips measured, and requests sent in batches, per transport
+		*		batch - Requests sent (post per request, one flush) before the replies are read
+		*		channel_name - Name the benchmark channel is created under
+		* Return: p50/p99/p999 round trip latency and requests per second of both transports
+		*/
+		static ChannelBenchmarkReport run(size_t payload = 64, size_t iterations = 100000, size_t batch = 64,
+			const char* channel_name = "WinServiceLibBenchmark")
+		{
+			ChannelBenchmarkReport report = {};
+			report.payload = payload ? payload : 1;
+			report.iterations = iterations ? iterations : 1;
+			report.batch = batch ? batch : 1;
+
+			report.channel = measureChannel(channel_name, report.payload, report.iterations, report.batch);
+			report.socket = measureSocket(report.payload, report.iterations, report.batch);
+
+			return report;
+		}
+	};
+}
+
+#endif /* COMMAND_CHANNEL_BENCHMARK_HPP_ */
\ No newline at end of file
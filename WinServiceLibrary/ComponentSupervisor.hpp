@@ -0,0 +1,564 @@
+#ifndef COMPONENT_SUPERVISOR_HPP_
+#define COMPONENT_SUPERVISOR_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Which components are restarted when a component fails
+	*/
+	enum class RestartStrategy
+	{
+		ONE_FOR_ONE,	//Only the failed component
+		ONE_FOR_ALL		//All the components, in registration order
+	};
+
+	/*
+	* Restart policy of a supervisor
+	*/
+	struct SupervisorPolicy
+	{
+		RestartStrategy		strategy;		//Which components are restarted
+		unsigned long		initialBackoff;	//Delay before the second restart within the window, in milliseconds (the first is immediate)
+		unsigned long		maxBackoff;		//Upper bound of the delay, in milliseconds
+		unsigned long		multiplier;		//Growth of the delay between consecutive restarts
+		unsigned long		maxRestarts;	//Restarts of one component allowed within the window before escalating
+		unsigned long		window;			//Crash-loop window, in milliseconds
+
+		SupervisorPolicy()
+			: strategy(RestartStrategy::ONE_FOR_ONE), initialBackoff(10), maxBackoff(5000), multiplier(2), maxRestarts(5), window(60000)
+		{}
+	};
+
+	/*
+	* Restart measurements of a supervisor
+	*/
+	struct SupervisorMetrics
+	{
+		unsigned long long	restarts;				//Failures handled by a restart
+		unsigned long long	restartedComponents;	//Components restarted in total, failed or not
+		unsigned long		lastAffected;			//Components restarted by the last restart
+		double				lastRestartLatency;		//Milliseconds from the last failure until the component ran again
+		double				maxRestartLatency;		//Highest restart latency, in milliseconds
+		double				averageRestartLatency;	//Average restart latency, in milliseconds
+		bool				escalated;				//Whether a crash loop was escalated to the service
+		std::string			escalatedComponent;		//The component whose crash loop was escalated
+		std::string			escalationError;		//Why that component last failed
+	};
+
+	/*
+	* State of a supervised component
+	*/
+	struct ComponentStatus
+	{
+		std::string			name;		//The name of the component
+		bool				running;	//Whether the component thread runs
+		unsigned long long	restarts;	//Number of times the component was restarted
+		std::string			lastError;	//Why the component last failed
+	};
+
+	/*
+	* Handed to a running component - tells it when to return
+	*/
+	class ComponentContext
+	{
+	private:
+		friend class ComponentSupervisor;
+
+		std::atomic<bool>			_stop;		//Set when the component must return
+		std::mutex					_lock;		//Guards the wake up
+		std::condition_variable		_wake;		//Signaled when _stop is set
+
+		ComponentContext()
+			: _stop(false)
+		{}
+
+		/* Ask the component to return */
+		void requestStop()
+		{
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				_stop = true;
+			}
+			_wake.notify_all();
+		}
+
+	public:
+		/* Return whether the component must return */
+		bool stopping() const
+		{
+			return _stop.load();
+		}
+
+		/*
+		* Method: waitFor
+		* Task: Sleep until the timeout elapses or the component must return
+		* Args: timeout - Maximum time to sleep in milliseconds
+		* Return: true if the component must return
+		*/
+		bool waitFor(unsigned long timeout)
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			return _wake.wait_for(guard, std::chrono::milliseconds(timeout), [this]() { return _stop.load(); });
+		}
+	};
+
+	/*
+	* Supervises the internal components of a service, each running on its own thread.
+	* A component fails when its function throws, or returns without being asked to. A failed component is
+	* restarted in-process by the supervisor thread - alone or together with the other components, following
+	* the strategy - while the components that are not affected keep serving. Consecutive restarts of a component
+	* are delayed with exponential backoff, and a component failing more than maxRestarts times within the window
+	* is a crash loop: all the components are stopped and the failure is escalated.
+	*/
+	class ComponentSupervisor
+	{
+	public:
+		/* Runs a component until ComponentContext::stopping() */
+		typedef std::function<void(ComponentContext&)> ComponentFunction;
+
+		/* Creates the thread of a component - role is the name of the component */
+		typedef std::function<std::thread(const std::string& role, std::function<void()> function)> ThreadFactory;
+
+		/* Called on the supervisor thread when a crash loop is escalated */
+		typedef std::function<void(const std::string& component, const std::string& error)> EscalationHandler;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		/*
+		* A registered component
+		*/
+		struct Component
+		{
+			std::string							name;		//The name of the component
+			ComponentFunction					function;	//The function of the component
+			std::unique_ptr<ComponentContext>	context;	//The context of the current run
+			std::thread							thread;		//The thread of the current run
+			bool								running;	//Whether the thread runs the function
+			bool								failed;		//Whether the current run failed and wasn't restarted yet
+			bool								restarting;	//Whether the current run is a restart, its latency is measured
+			Clock::time_point					failedAt;	//When the failure that caused the restart was detected
+			std::deque<Clock::time_point>		history;	//Restarts within the crash-loop window
+			unsigned long long					restarts;	//Number of restarts
+			std::string							lastError;	//Why the component last failed
+		};
+
+		std::vector<std::unique_ptr<Component>>	_components;	//Registered components
+		SupervisorPolicy					_policy;		//The restart policy
+		ThreadFactory						_factory;		//Creates the component threads
+		EscalationHandler					_escalation;	//Called when a crash loop is escalated
+		std::thread							_monitor;		//The supervisor thread
+		std::mutex							_lock;			//Guards the state of the components and the metrics
+		std::mutex							_stopLock;		//Serializes stop requests
+		std::condition_variable				_wake;			//Wakes the supervisor thread
+		std::deque<size_t>					_failures;		//Failed components waiting for the supervisor thread
+		bool								_started;		//Whether the supervisor runs
+		bool								_stopping;		//Whether the supervisor thread must exit
+		SupervisorMetrics					_metrics;		//Restart measurements
+		double								_totalLatency;	//Sum of the restart latencies, in milliseconds
+		unsigned long long					_latencies;		//Number of restart latencies measured
+
+		/*
+		* Method: body
+		* Task: The thread function of a component - runs it and reports its failure
+		* Args: component - The component to run
+		* Return: None
+		*/
+		void body(Component* component)
+		{
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				if (component->restarting)
+				{
+					double latency = std::chrono::duration<double, std::milli>(Clock::now() - component->failedAt).count();
+					component->restarting = false;
+
+					_totalLatency += latency;
+					++_latencies;
+					_metrics.lastRestartLatency = latency;
+					_metrics.maxRestartLatency = (std::max)(_metrics.maxRestartLatency, latency);
+					_metrics.averageRestartLatency = _totalLatency / static_cast<double>(_latencies);
+				}
+			}
+
+			ComponentContext& context = *component->context;
+			std::string error;
+
+			try
+			{
+				component->function(context);
+				if (!context.stopping())
+				{
+					error = "Component returned unexpectedly";
+				}
+			}
+			catch (const std::exception& ex)
+			{
+				error = ex.what();
+			}
+			catch (...)
+			{
+				error = "Unknown exception";
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				component->running = false;
+
+				//Failures while stopping are part of the stop
+				if (!error.empty() && !context.stopping())
+				{
+					component->failed = true;
+					component->failedAt = Clock::now();
+					component->lastError = error;
+					_failures.push_back(index(component));
+				}
+			}
+			_wake.notify_all();
+		}
+
+		/* Return the registration index of a component */
+		size_t index(const Component* component) const
+		{
+			for (size_t i = 0; i < _components.size(); ++i)
+			{
+				if (_components[i].get() == component)
+				{
+					return i;
+				}
+			}
+			return _components.size();
+		}
+
+		/* Start a run of a component. The previous run must have been joined. */
+		void launch(Component* component)
+		{
+			component->context.reset(new ComponentContext());
+			component->running = true;
+			component->failed = false;
+			component->thread = _factory(component->name, [this, component]() { body(component); });
+		}
+
+		/* Ask a component to return and wait for its thread */
+		static void halt(Component* component)
+		{
+			if (component->context)
+			{
+				component->context->requestStop();
+			}
+
+			if (component->thread.joinable())
+			{
+				component->thread.join();
+			}
+		}
+
+		/* Stop all the components - the stop requests are sent first so they stop concurrently */
+		void haltAll()
+		{
+			for (auto& component : _components)
+			{
+				if (component->context)
+				{
+					component->context->requestStop();
+				}
+			}
+
+			for (auto& component : _components)
+			{
+				halt(component.get());
+			}
+		}
+
+		/*
+		* Method: backoff
+		* Task: Return the delay before a restart
+		* Args: recent - Restarts of the component within the window, before this one
+		* Return: The delay in milliseconds
+		*/
+		unsigned long backoff(size_t recent) const
+		{
+			if (recent == 0)
+			{
+				return 0;
+			}
+
+			unsigned long long delay = _policy.initialBackoff;
+			for (size_t i = 1; i < recent && delay < _policy.maxBackoff; ++i)
+			{
+				delay *= (std::max)(_policy.multiplier, 1UL);
+			}
+			return static_cast<unsigned long>((std::min)(delay, static_cast<unsigned long long>(_policy.maxBackoff)));
+		}
+
+		/*
+		* Method: restart
+		* Task: Restart a failed component following the strategy. Called on the supervisor thread, without the lock.
+		* Args: failed - The failed component
+		* Return: Number of restarted components
+		*/
+		unsigned long restart(Component* failed)
+		{
+			std::vector<Component*> affected;
+
+			if (_policy.strategy == RestartStrategy::ONE_FOR_ALL)
+			{
+				for (auto& component : _components)
+				{
+					affected.push_back(component.get());
+					if (component->context)
+					{
+						component->context->requestStop();
+					}
+				}
+			}
+			else
+			{
+				affected.push_back(failed);
+			}
+
+			for (Component* component : affected)
+			{
+				halt(component);
+			}
+
+			std::lock_guard<std::mutex> guard(_lock);
+			Clock::time_point failed_at = failed->failedAt;
+
+			for (Component* component : affected)
+			{
+				component->restarting = true;
+				component->failedAt = failed_at;
+				++component->restarts;
+				++_metrics.restartedComponents;
+				launch(component);
+			}
+
+			++_metrics.restarts;
+			_metrics.lastAffected = static_cast<unsigned long>(affected.size());
+			return _metrics.lastAffected;
+		}
+
+		/* The supervisor thread - handles the failures one at a time */
+		void monitor()
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+
+			for (;;)
+			{
+				_wake.wait(guard, [this]() { return _stopping || !_failures.empty(); });
+				if (_stopping)
+				{
+					return;
+				}
+
+				Component* component = _components[_failures.front()].get();
+				_failures.pop_front();
+
+				//Already restarted with the other components, or running again
+				if (!component->failed || component->running)
+				{
+					continue;
+				}
+
+				Clock::time_point now = Clock::now();
+				while (!component->history.empty() && now - component->history.front() > std::chrono::milliseconds(_policy.window))
+				{
+					component->history.pop_front();
+				}
+
+				if (component->history.size() >= _policy.maxRestarts)
+				{
+					std::string name = component->name;
+					std::string error = component->lastError;
+
+					_metrics.escalated = true;
+					_metrics.escalatedComponent = name;
+					_metrics.escalationError = error;
+					_stopping = true;
+					guard.unlock();
+
+					haltAll();
+					if (_escalation)
+					{
+						_escalation(name, error);
+					}
+					return;
+				}
+
+				unsigned long delay = backoff(component->history.size());
+				component->history.push_back(now);
+
+				if (delay && _wake.wait_for(guard, std::chrono::milliseconds(delay), [this]() { return _stopping; }))
+				{
+					return;
+				}
+
+				guard.unlock();
+				restart(component);
+				guard.lock();
+			}
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct a supervisor without components
+		* Args: None
+		* Returns: Instance of ComponentSupervisor
+		*/
+		ComponentSupervisor()
+			: _started(false), _stopping(false), _metrics(), _totalLatency(0), _latencies(0)
+		{}
+
+		/*
+		* Method: Destructor
+		* Task: Stop the components
+		* Args: None
+		* Returns: None
+		*/
+		~ComponentSupervisor()
+		{
+			stop();
+		}
+
+		ComponentSupervisor(const ComponentSupervisor&) = delete;
+		ComponentSupervisor& operator=(const ComponentSupervisor&) = delete;
+
+		/* Set the restart policy - before start */
+		void setPolicy(const SupervisorPolicy& policy)
+		{
+			_policy = policy;
+		}
+
+		/* Return the restart policy */
+		const SupervisorPolicy& getPolicy() const
+		{
+			return _policy;
+		}
+
+		/*
+		* Method: add
+		* Task: Register a component - before start. Components start in registration order.
+		* Args: name - The name of the component, also the placement role of its thread
+		*		function - Runs the component until ComponentContext::stopping(), throws on failure
+		* Return: None
+		*/
+		void add(const std::string& name, ComponentFunction function)
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			if (_started)
+			{
+				throw std::logic_error("Components must be added before the supervisor starts");
+			}
+
+			std::unique_ptr<Component> component(new Component());
+			component->name = name;
+			component->function = function;
+			component->running = false;
+			component->failed = false;
+			component->restarting = false;
+			component->restarts = 0;
+			_components.push_back(std::move(component));
+		}
+
+		/* Return the number of registered components */
+		size_t size() const
+		{
+			return _components.size();
+		}
+
+		/*
+		* Method: start
+		* Task: Start all the components and the supervisor thread
+		* Args: factory - Creates the component threads
+		*		escalation - Called on the supervisor thread after a crash loop stopped all the components
+		* Return: None
+		*/
+		void start(ThreadFactory factory, EscalationHandler escalation = EscalationHandler())
+		{
+			stop();
+
+			std::lock_guard<std::mutex> guard(_lock);
+			_factory = factory ? factory : [](const std::string&, std::function<void()> function) { return std::thread(function); };
+			_escalation = escalation;
+			_failures.clear();
+			_stopping = false;
+			_metrics = SupervisorMetrics();
+			_totalLatency = 0;
+			_latencies = 0;
+
+			for (auto& component : _components)
+			{
+				component->history.clear();
+				component->restarting = false;
+				launch(component.get());
+			}
+
+			_monitor = std::thread([this]() { monitor(); });
+			_started = true;
+		}
+
+		/*
+		* Method: stop
+		* Task: Stop the supervisor thread and all the components. May be called from the escalation handler.
+		* Args: None
+		* Return: None
+		*/
+		void stop()
+		{
+			std::lock_guard<std::mutex> stop_guard(_stopLock);
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				_stopping = true;
+			}
+			_wake.notify_all();
+
+			//The escalation handler runs on the supervisor thread, which exits after it returns
+			if (_monitor.joinable() && _monitor.get_id() != std::this_thread::get_id())
+			{
+				_monitor.join();
+			}
+
+			haltAll();
+
+			std::lock_guard<std::mutex> guard(_lock);
+			_started = false;
+		}
+
+		/* Return the restart measurements */
+		SupervisorMetrics getMetrics()
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			return _metrics;
+		}
+
+		/* Return the state of every component, in registration order */
+		std::vector<ComponentStatus> getStatus()
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			std::vector<ComponentStatus> status;
+
+			for (const auto& component : _components)
+			{
+				status.push_back({ component->name, component->running, component->restarts, component->lastError });
+			}
+			return status;
+		}
+	};
+}
+
+#endif /* COMPONENT_SUPERVISOR_HPP_ */
\ No newline at end of file
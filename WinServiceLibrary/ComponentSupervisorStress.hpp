@@ -0,0 +1,208 @@
+#ifndef COMPONENT_SUPERVISOR_STRESS_HPP_
+#define COMPONENT_SUPERVISOR_STRESS_HPP_
+
+#include "ComponentSupervisor.hpp"
+#include "StressHarness.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Result of a restart run of the component supervisor
+	*/
+	struct SupervisorStressReport : HarnessReport
+	{
+		RestartStrategy				strategy;				//The strategy under test
+		size_t						components;				//Number of supervised components
+		unsigned long				failures;				//Failures injected into the faulty component
+		unsigned long long			restarts;				//Failures handled by a restart
+		unsigned long long			restartedComponents;	//Components restarted in total
+		double						averageRestartLatency;	//Milliseconds from a failure until the component ran again
+		double						maxRestartLatency;		//Highest restart latency, in milliseconds
+		bool						escalated;				//Whether the crash loop of the faulty component was escalated
+	};
+
+	/*
+	* Restart check of ComponentSupervisor. One of the supervised components fails on demand while the others serve,
+	* and the harness checks:
+	*	- every failure is handled by exactly one restart, and the faulty component runs again
+	*	- ONE_FOR_ONE restarts the faulty component only, the others keep running without a restart
+	*	- ONE_FOR_ALL restarts every component on every failure
+	*	- a component failing more than maxRestarts times within the window is escalated with its name and error
+	* Backoff is disabled, so the restart latencies are the ones of the supervisor itself.
+	*/
+	class ComponentSupervisorStress : private StressHarness
+	{
+	private:
+		/* Name and error of the faulty component */
+		static constexpr const char* FAULTY = "faulty";
+		static constexpr const char* INJECTED = "Injected failure";
+
+		std::mutex					_lock;			//Guards _escalated, _component and _error
+		std::condition_variable		_escalation;	//Signaled when the supervisor escalates
+		bool						_escalated;		//Whether the escalation handler ran
+		std::string					_component;		//Component passed to the escalation handler
+		std::string					_error;			//Error passed to the escalation handler
+		std::atomic<bool>			_inject;		//The faulty component fails when set
+		std::atomic<bool>			_crash;			//The faulty component fails on every run when set
+		SupervisorStressReport		_report;		//The report being collected
+
+		ComponentSupervisorStress()
+			: _escalated(false), _inject(false), _crash(false), _report()
+		{}
+
+		/* Return whether every component of the supervisor runs */
+		static bool allRunning(ComponentSupervisor& supervisor)
+		{
+			for (const ComponentStatus& status : supervisor.getStatus())
+			{
+				if (!status.running)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/*
+		* Method: execute
+		* Task: Run the check on an initialized harness
+		* Args: strategy, components, failures - see run
+		* Return: The report
+		*/
+		SupervisorStressReport execute(RestartStrategy strategy, size_t components, unsigned long failures)
+		{
+			ComponentSupervisor supervisor;
+			SupervisorPolicy policy;
+			policy.strategy = strategy;
+			policy.initialBackoff = 0;
+			policy.maxBackoff = 0;
+			policy.maxRestarts = failures + 1;
+
+			_report.strategy = strategy;
+			_report.components = components;
+			_report.failures = failures;
+
+			supervisor.add(FAULTY, [this](ComponentContext& context)
+			{
+				while (!context.waitFor(1))
+				{
+					if (_crash || _inject.exchange(false))
+					{
+						throw std::runtime_error(INJECTED);
+					}
+				}
+			});
+
+			for (size_t index = 1; index < components; ++index)
+			{
+				supervisor.add("worker " + std::to_string(index), [](ComponentContext& context)
+				{
+					while (!context.waitFor(1))
+					{
+					}
+				});
+			}
+
+			supervisor.setPolicy(policy);
+			supervisor.start(ComponentSupervisor::ThreadFactory(), [this](const std::string& component, const std::string& error)
+			{
+				{
+					std::lock_guard<std::mutex> guard(_lock);
+					_escalated = true;
+					_component = component;
+					_error = error;
+				}
+				_escalation.notify_all();
+			});
+
+			//Restarts - one failure at a time
+			for (unsigned long failure = 1; failure <= failures; ++failure)
+			{
+				_inject = true;
+
+				if (!settle([&]() { return supervisor.getMetrics().restarts >= failure && allRunning(supervisor); }))
+				{
+					violation("Failure " + std::to_string(failure) + " was not restarted");
+					break;
+				}
+
+				unsigned long expected = strategy == RestartStrategy::ONE_FOR_ALL ? static_cast<unsigned long>(components) : 1;
+				if (supervisor.getMetrics().lastAffected != expected)
+				{
+					violation("Failure " + std::to_string(failure) + " restarted " + std::to_string(supervisor.getMetrics().lastAffected) +
+						" components instead of " + std::to_string(expected));
+				}
+			}
+
+			for (const ComponentStatus& status : supervisor.getStatus())
+			{
+				bool faulty = status.name == FAULTY;
+				unsigned long long expected = (faulty || strategy == RestartStrategy::ONE_FOR_ALL) ? failures : 0;
+
+				if (status.restarts != expected)
+				{
+					violation(status.name + " restarted " + std::to_string(status.restarts) + " times instead of " + std::to_string(expected));
+				}
+			}
+
+			SupervisorMetrics metrics = supervisor.getMetrics();
+			_report.restarts = metrics.restarts;
+			_report.restartedComponents = metrics.restartedComponents;
+			_report.averageRestartLatency = metrics.averageRestartLatency;
+			_report.maxRestartLatency = metrics.maxRestartLatency;
+
+			if (metrics.restarts != failures)
+			{
+				violation(std::to_string(metrics.restarts) + " restarts for " + std::to_string(failures) + " failures");
+			}
+
+			//Crash loop - the faulty component fails on every run until the supervisor gives up
+			_crash = true;
+			{
+				std::unique_lock<std::mutex> guard(_lock);
+				_report.escalated = _escalation.wait_for(guard, std::chrono::milliseconds(SETTLE_TIMEOUT), [this]() { return _escalated; });
+			}
+
+			if (!_report.escalated)
+			{
+				violation("The crash loop was not escalated");
+			}
+			else if (_component != FAULTY || _error != INJECTED ||
+				supervisor.getMetrics().escalatedComponent != FAULTY || supervisor.getMetrics().escalationError != INJECTED)
+			{
+				violation("The escalation reported " + _component + ": " + _error + " instead of the faulty component");
+			}
+
+			supervisor.stop();
+			collect(_report);
+			return _report;
+		}
+
+	public:
+		/*
+		* Method: run
+		* Task: Fail one component of a supervisor repeatedly, measure the restarts and check which components they affect,
+		*		then drive the component into a crash loop and check it's escalated
+		* Args: strategy - The restart strategy under test
+		*		components - Number of supervised components, including the faulty one
+		*		failures - Number of failures restarted before the crash loop
+		* Return: Restart latencies, restarted components and violated expectations
+		*/
+		static SupervisorStressReport run(RestartStrategy strategy = RestartStrategy::ONE_FOR_ONE, size_t components = 4, unsigned long failures = 20)
+		{
+			ComponentSupervisorStress harness;
+			return harness.execute(strategy, components ? components : 1, failures);
+		}
+	};
+}
+
+#endif /* COMPONENT_SUPERVISOR_STRESS_HPP_ */
\ No newline at end of file
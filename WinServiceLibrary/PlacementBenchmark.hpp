@@ -0,0 +1,149 @@
+#ifndef PLACEMENT_BENCHMARK_HPP_
+#define PLACEMENT_BENCHMARK_HPP_
+
+#include "ServicePlacement.hpp"
+#include "StressHarness.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Result of a placement benchmark run
+	*/
+	struct PlacementBenchmarkReport
+	{
+		size_t					iterations;		//Round trips measured per run
+		bool					applied;		//Whether the placement of both roles was applied
+		LatencyPercentiles		unplaced;		//Round trip latency with the threads placed by the scheduler
+		LatencyPercentiles		placed;			//Round trip latency with the threads following the placement policy
+	};
+
+	/*
+	* Measures what a placement policy does to the latency of a service: a requesting thread hands a request
+	* to a serving thread and waits for its answer - the hand-off pattern of the command channel and of worker
+	* queues - once with the threads placed by the scheduler and once with the threads following the policy
+	* of their roles. Only the thread part of the policy is applied, the calling process keeps its placement;
+	* give the roles masks within the process affinity the policy would set.
+	*/
+	class PlacementBenchmark
+	{
+	private:
+		/* Spins of a waiting thread before it yields its processor */
+		static const int SPINS_BEFORE_YIELD = 1000;
+
+		/* Wait until a flag holds the expected value, spinning first like a latency sensitive service would */
+		static void await(const std::atomic<size_t>& flag, size_t expected)
+		{
+			for (int spins = 0; flag.load(std::memory_order_acquire) != expected; ++spins)
+			{
+				if (spins >= SPINS_BEFORE_YIELD)
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		/*
+		* Method: measure
+		* Task: Measure the round trips between a requesting and a serving thread
+		* Args: policy - The placement policy, NULL - leave the threads to the scheduler
+		*		client_role, server_role - The roles of the requesting and the serving thread
+		*		iterations - Number of round trips to measure
+		*		applied - Set to false if the placement of a role couldn't be applied
+		* Return: The latency distribution
+		*/
+		static LatencyPercentiles measure(const PlacementPolicy* policy, const std::string& client_role, const std::string& server_role,
+			size_t iterations, bool& applied)
+		{
+			std::atomic<size_t> request(0);
+			std::atomic<size_t> response(0);
+			std::atomic<bool> server_applied(true);
+			std::vector<double> samples(iterations);
+
+			std::thread server([&]()
+			{
+				if (policy)
+				{
+					try
+					{
+						ServicePlacement::applyThread(*policy, server_role);
+					}
+					catch (const WinApiLastErrorException&)
+					{
+						server_applied = false;
+					}
+				}
+
+				for (size_t i = 1; i <= iterations; ++i)
+				{
+					await(request, i);
+					response.store(i, std::memory_order_release);
+				}
+			});
+
+			std::thread client([&]()
+			{
+				if (policy)
+				{
+					try
+					{
+						ServicePlacement::applyThread(*policy, client_role);
+					}
+					catch (const WinApiLastErrorException&)
+					{
+						applied = false;
+					}
+				}
+
+				for (size_t i = 1; i <= iterations; ++i)
+				{
+					auto begin = std::chrono::steady_clock::now();
+					request.store(i, std::memory_order_release);
+					await(response, i);
+					samples[i - 1] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+				}
+			});
+
+			client.join();
+			server.join();
+			applied = applied && server_applied;
+
+			return LatencyPercentiles::of(samples);
+		}
+
+	public:
+		/* Static class - deleted constructor & destructor */
+		PlacementBenchmark() = delete;
+		~PlacementBenchmark() = delete;
+
+		/*
+		* Method: run
+		* Task: Measure the request/answer round trip latency between threads of two roles, without and with a placement policy
+		* Args: policy - The placement policy, as stored with ServiceManager::setServicePlacement
+		*		client_role - The role of the requesting thread
+		*		server_role - The role of the serving thread
+		*		iterations - Number of round trips measured per run
+		* Return: p50/p99/p999 and maximum latency of both runs
+		*/
+		static PlacementBenchmarkReport run(const PlacementPolicy& policy, const std::string& client_role = "main",
+			const std::string& server_role = "worker", size_t iterations = 100000)
+		{
+			PlacementBenchmarkReport report = {};
+			bool unused = true;
+
+			report.iterations = iterations ? iterations : 1;
+			report.applied = true;
+			report.unplaced = measure(NULL, client_role, server_role, report.iterations, unused);
+			report.placed = measure(&policy, client_role, server_role, report.iterations, report.applied);
+
+			return report;
+		}
+	};
+}
+
+#endif /* PLACEMENT_BENCHMARK_HPP_ */
\ No newline at end of file
@@ -0,0 +1,426 @@
+#ifndef REMOTE_SERVICE_AGENT_HPP_
+#define REMOTE_SERVICE_AGENT_HPP_
+
+#include "RemoteServiceProtocol.hpp"
+#include "ServiceManager.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Who may use an agent, and how much. Every agent requires the shared secret - the loopback is reachable
+	* by any local process, and the agent controls services with its own privileges.
+	* allowUnauthenticated is an explicit opt-in for agents which don't need the secret, e.g. stand-in agents
+	* with a custom handler in tests. An unauthenticated agent beyond the loopback still requires an allow list.
+	*/
+	struct AgentSecurity
+	{
+		std::string					secret;					//Shared secret the controllers must prove
+		std::vector<std::string>	allowedPeers;			//Numeric IPv4 addresses allowed to connect, empty - any
+		bool						allowUnauthenticated;	//Accept controllers without the secret when it's empty
+		unsigned long				idleTimeout;			//Milliseconds a controller may stay silent before it's disconnected
+		size_t						maxClients;				//Maximum number of connected controllers
+
+		AgentSecurity(const std::string& secret = "", const std::vector<std::string>& allowed_peers = std::vector<std::string>())
+			: secret(secret), allowedPeers(allowed_peers), allowUnauthenticated(false), idleTimeout(60000), maxClients(64)
+		{}
+	};
+
+	/*
+	* Small per-host agent - accepts connections from RemoteServiceControllers and executes
+	* the requested operations on the local SCM through the ServiceManager.
+	* A custom handler can replace the SCM, which allows running stand-in agents on the loopback.
+	*/
+	class RemoteServiceAgent
+	{
+	public:
+		typedef std::function<RemoteProtocol::Reply(const RemoteProtocol::Request&)> Handler;
+
+	private:
+		struct Worker
+		{
+			std::thread							thread;		//Serves a single controller
+			std::shared_ptr<std::atomic<bool>>	done;		//Set when the controller disconnected
+		};
+
+		RemoteProtocol::WinSockSession	_session;		//Keeps WinSock loaded while the agent lives
+		Handler							_handler;		//Executes the requests
+		AgentSecurity					_security;		//Authentication and allow list
+		SOCKET							_listener;		//The listening socket, closed by stop
+		unsigned short					_port;			//The port the agent listens on
+		std::atomic<bool>				_running;		//Whether the accept loop should keep running
+		std::mutex						_clientsLock;	//Guards _listener, _clients and _workers
+		std::vector<SOCKET>				_clients;		//Connected controllers
+		std::list<Worker>				_workers;		//One worker per connected controller
+
+		/*
+		* Method: serve
+		* Task: Serve requests of a single connected controller until it disconnects
+		* Args: client - The connected socket
+		* Return: None
+		*/
+		void serve(SOCKET client, std::shared_ptr<std::atomic<bool>> done)
+		{
+			std::string line;
+
+			try
+			{
+				if (!authenticate(client))
+				{
+					closeClient(client);
+					*done = true;
+					return;
+				}
+
+				while (_running && RemoteProtocol::receiveLine(client, line))
+				{
+					RemoteProtocol::Request request;
+					RemoteProtocol::Reply reply;
+
+					if (!RemoteProtocol::parseRequest(line, request))
+					{
+						reply = { false, 0, ERROR_INVALID_DATA, "Malformed request" };
+					}
+					else
+					{
+						reply = _handler(request);
+					}
+
+					RemoteProtocol::sendLine(client, RemoteProtocol::formatReply(reply));
+				}
+			}
+			catch (const std::exception&)
+			{
+				//Connection is broken - the controller will reconnect
+			}
+
+			closeClient(client);
+			*done = true;
+		}
+
+		/*
+		* Method: authenticate
+		* Task: Greet a controller and check it proves the secret, unless the agent opted in to unauthenticated use
+		* Args: client - The connected socket
+		* Return: true if the controller may send requests
+		*/
+		bool authenticate(SOCKET client)
+		{
+			if (_security.secret.empty() && _security.allowUnauthenticated)
+			{
+				RemoteProtocol::sendLine(client, "HELLO\n");
+				return true;
+			}
+
+			std::string nonce = RemoteProtocol::createNonce();
+			std::string line;
+			RemoteProtocol::sendLine(client, "HELLO " + nonce + "\n");
+
+			if (!RemoteProtocol::receiveLine(client, line))
+			{
+				return false;
+			}
+
+			static const std::string AUTH = "AUTH ";
+			bool authenticated = line.compare(0, AUTH.size(), AUTH) == 0 &&
+				RemoteProtocol::equalProofs(line.substr(AUTH.size()), RemoteProtocol::computeProof(_security.secret, nonce));
+
+			RemoteProtocol::Reply reply = { true, 0, 0, "" };
+			if (!authenticated)
+			{
+				reply = { false, 0, ERROR_ACCESS_DENIED, "Access denied" };
+			}
+			RemoteProtocol::sendLine(client, RemoteProtocol::formatReply(reply));
+
+			return authenticated;
+		}
+
+		/*
+		* Method: isAllowed
+		* Task: Check the address of a connected controller against the allow list
+		* Args: client - The connected socket
+		* Return: true if the controller may connect
+		*/
+		bool isAllowed(SOCKET client) const
+		{
+			if (_security.allowedPeers.empty())
+			{
+				return true;
+			}
+
+			sockaddr_in peer = {};
+			int length = sizeof(peer);
+			char address[INET_ADDRSTRLEN] = {};
+
+			if (getpeername(client, reinterpret_cast<sockaddr*>(&peer), &length) != 0 ||
+				inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address)) == NULL)
+			{
+				return false;
+			}
+
+			return std::find(_security.allowedPeers.begin(), _security.allowedPeers.end(), std::string(address)) != _security.allowedPeers.end();
+		}
+
+		/*
+		* Method: reapWorkers
+		* Task: Join the workers of controllers that already disconnected. Called with _clientsLock held.
+		* Args: None
+		* Return: None
+		*/
+		void reapWorkers()
+		{
+			for (auto it = _workers.begin(); it != _workers.end();)
+			{
+				if (*it->done)
+				{
+					it->thread.join();
+					it = _workers.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+
+		/*
+		* Method: closeClient
+		* Task: Close a client connection and forget about it
+		* Args: client - The socket to close
+		* Return: None
+		*/
+		void closeClient(SOCKET client)
+		{
+			std::lock_guard<std::mutex> guard(_clientsLock);
+
+			for (auto it = _clients.begin(); it != _clients.end(); ++it)
+			{
+				if (*it == client)
+				{
+					closesocket(client);
+					_clients.erase(it);
+					break;
+				}
+			}
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct agent bound to the given address and port.
+		*		The agent controls services with its own privileges, so it listens on the loopback by default and
+		*		requires a shared secret on every address unless security.allowUnauthenticated is set.
+		* Args: port - The port to listen on (0 selects a free port, see getPort)
+		*		bind_address - The local address to listen on
+		*		handler - Executes the requests, defaults to the local SCM
+		*		security - Shared secret, allow list and connection limits of the controllers
+		* Returns: Instance of RemoteServiceAgent
+		*/
+		RemoteServiceAgent(unsigned short port, const char* bind_address = "127.0.0.1", Handler handler = &RemoteServiceAgent::localHandler,
+			const AgentSecurity& security = AgentSecurity())
+			: _handler(handler), _security(security), _listener(INVALID_SOCKET), _port(port), _running(false)
+		{
+			sockaddr_in address = {};
+			address.sin_family = AF_INET;
+			address.sin_port = htons(port);
+			if (inet_pton(AF_INET, bind_address, &address.sin_addr) != 1)
+			{
+				throw WinApiLastErrorException("Invalid agent bind address", WSAGetLastError());
+			}
+
+			if (_security.secret.empty())
+			{
+				bool loopback = (ntohl(address.sin_addr.s_addr) >> 24) == (INADDR_LOOPBACK >> 24);
+				if (!_security.allowUnauthenticated)
+				{
+					throw WinApiLastErrorException("The agent requires a shared secret", ERROR_ACCESS_DENIED);
+				}
+				if (!loopback && _security.allowedPeers.empty())
+				{
+					throw WinApiLastErrorException("An unauthenticated agent listening beyond the loopback requires an allow list", ERROR_ACCESS_DENIED);
+				}
+			}
+
+			if ((_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
+			{
+				throw WinApiLastErrorException("socket failed", WSAGetLastError());
+			}
+
+			if (bind(_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+				listen(_listener, SOMAXCONN) == SOCKET_ERROR)
+			{
+				int error = WSAGetLastError();
+				closesocket(_listener);
+				throw WinApiLastErrorException("Agent failed to listen", error);
+			}
+
+			int length = sizeof(address);
+			if (getsockname(_listener, reinterpret_cast<sockaddr*>(&address), &length) == 0)
+			{
+				_port = ntohs(address.sin_port);
+			}
+		}
+
+		/*
+		* Method: Destructor
+		* Task: Stop the agent and close all connections
+		* Args: None
+		* Returns: None
+		*/
+		~RemoteServiceAgent()
+		{
+			stop();
+		}
+
+		RemoteServiceAgent(const RemoteServiceAgent&) = delete;
+		RemoteServiceAgent& operator=(const RemoteServiceAgent&) = delete;
+
+		/* Return the port the agent listens on */
+		unsigned short getPort() const
+		{
+			return _port;
+		}
+
+		/*
+		* Method: run
+		* Task: Accept controllers and serve them until stop is called. Blocks the calling thread.
+		* Args: None
+		* Return: None
+		*/
+		void run()
+		{
+			_running = true;
+
+			SOCKET listener;
+			{
+				std::lock_guard<std::mutex> guard(_clientsLock);
+				listener = _listener;
+			}
+
+			while (_running)
+			{
+				SOCKET client = accept(listener, NULL, NULL);
+				if (client == INVALID_SOCKET)
+				{
+					//The listener is closed by stop
+					break;
+				}
+
+				if (!isAllowed(client))
+				{
+					closesocket(client);
+					continue;
+				}
+
+				//Replies are small, don't let Nagle delay them. A silent controller is disconnected, it reconnects when needed.
+				BOOL no_delay = TRUE;
+				DWORD idle_timeout = _security.idleTimeout;
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+				setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&idle_timeout), sizeof(idle_timeout));
+
+				std::lock_guard<std::mutex> guard(_clientsLock);
+				reapWorkers();
+
+				//stop swaps the workers out under the lock - a worker started after that would never be joined
+				if (!_running || _clients.size() >= _security.maxClients)
+				{
+					closesocket(client);
+					continue;
+				}
+
+				auto done = std::make_shared<std::atomic<bool>>(false);
+				_clients.push_back(client);
+				_workers.push_back({ std::thread(&RemoteServiceAgent::serve, this, client, done), done });
+			}
+		}
+
+		/*
+		* Method: stop
+		* Task: Stop accepting controllers, disconnect the connected ones and wait for their workers
+		* Args: None
+		* Return: None
+		*/
+		void stop()
+		{
+			_running = false;
+
+			std::list<Worker> workers;
+			{
+				std::lock_guard<std::mutex> guard(_clientsLock);
+				if (_listener != INVALID_SOCKET)
+				{
+					//Wakes up the blocked accept
+					closesocket(_listener);
+					_listener = INVALID_SOCKET;
+				}
+
+				for (SOCKET client : _clients)
+				{
+					//Wakes up the blocked recv, the worker closes the socket
+					shutdown(client, SD_BOTH);
+				}
+				workers.swap(_workers);
+			}
+
+			for (Worker& worker : workers)
+			{
+				worker.thread.join();
+			}
+		}
+
+		/*
+		* Method: localHandler
+		* Task: Default handler - executes the request on the local SCM
+		* Args: request - The request to execute
+		* Return: The reply to send to the controller
+		*/
+		static RemoteProtocol::Reply localHandler(const RemoteProtocol::Request& request)
+		{
+			RemoteProtocol::Reply reply = { true, 0, 0, "" };
+			const char* name = request.service_name.c_str();
+
+			try
+			{
+				switch (request.verb)
+				{
+				case RemoteProtocol::Verb::START:
+					ServiceManager::startService(name);
+					reply.state = ServiceManager::queryService(name);
+					break;
+				case RemoteProtocol::Verb::STOP:
+					ServiceManager::stopService(name);
+					reply.state = SERVICE_STOPPED;
+					break;
+				case RemoteProtocol::Verb::QUERY:
+					reply.state = ServiceManager::queryService(name);
+					break;
+				case RemoteProtocol::Verb::CONTROL:
+					reply.state = ServiceManager::sendControl(name, request.control_code);
+					break;
+				default:
+					throw std::exception("Unknown control requested");
+				}
+			}
+			catch (const WinApiLastErrorException& ex)
+			{
+				reply = { false, 0, ex.lastErrorCode, ex.what() };
+			}
+			catch (const std::exception& ex)
+			{
+				reply = { false, 0, 0, ex.what() };
+			}
+
+			return reply;
+		}
+	};
+}
+
+#endif /* REMOTE_SERVICE_AGENT_HPP_ */
\ No newline at end of file
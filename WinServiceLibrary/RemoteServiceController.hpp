@@ -0,0 +1,490 @@
+#ifndef REMOTE_SERVICE_CONTROLLER_HPP_
+#define REMOTE_SERVICE_CONTROLLER_HPP_
+
+#include "RemoteServiceProtocol.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Fan-out controller - issues start, stop, query and custom controls to the RemoteServiceAgents
+	* of many hosts concurrently. Connections to the agents are pooled and reused between calls,
+	* the number of requests in flight is capped and the results are aggregated per host.
+	*/
+	class RemoteServiceController
+	{
+	public:
+		struct Host
+		{
+			std::string		address;	//Numeric address or host name of the agent
+			unsigned short	port;		//The port the agent listens on
+		};
+
+		struct Result
+		{
+			Host			host;		//The host the request was sent to
+			bool			succeeded;	//Whether the request succeeded
+			unsigned long	state;		//The service state reported by the agent (when succeeded)
+			unsigned long	error;		//The error code (when failed, 0 if unknown)
+			std::string		message;	//The error message (when failed)
+			double			latency_ms;	//Time from sending the request to receiving the reply (including connect)
+		};
+
+	private:
+		RemoteProtocol::WinSockSession				_session;		//Keeps WinSock loaded while the controller lives
+		size_t										_maxInFlight;	//Maximum number of concurrent requests
+		size_t										_maxIdle;		//Maximum number of pooled connections per host
+		unsigned long								_timeout;		//Connect/send/receive timeout in milliseconds
+		std::string									_secret;		//Shared secret proven to agents that require it
+		std::mutex									_poolLock;		//Guards _pool
+		std::map<std::string, std::vector<SOCKET>>	_pool;			//Idle connections by host key
+
+		/* Return the pool key of a host */
+		static std::string hostKey(const Host& host)
+		{
+			return host.address + ":" + std::to_string(host.port);
+		}
+
+		/*
+		* Method: connectAddress
+		* Task: Connect a socket to an address within the controller timeout - a blocking connect
+		*		to a dead host would hold the worker until the TCP retries give up
+		* Args: connection - The new socket
+		*		address - The address to connect to
+		* Return: 0 if connected, the WinSock error otherwise
+		*/
+		int connectAddress(SOCKET connection, const addrinfo* address) const
+		{
+			u_long non_blocking = 1;
+			if (ioctlsocket(connection, FIONBIO, &non_blocking) == SOCKET_ERROR)
+			{
+				return WSAGetLastError();
+			}
+
+			if (connect(connection, address->ai_addr, static_cast<int>(address->ai_addrlen)) == SOCKET_ERROR)
+			{
+				int error = WSAGetLastError();
+				if (error != WSAEWOULDBLOCK)
+				{
+					return error;
+				}
+
+				fd_set writable;
+				fd_set failed;
+				timeval timeout = { static_cast<long>(_timeout / 1000), static_cast<long>((_timeout % 1000) * 1000) };
+
+				FD_ZERO(&writable);
+				FD_ZERO(&failed);
+				FD_SET(connection, &writable);
+				FD_SET(connection, &failed);
+
+				int ready = select(0, NULL, &writable, &failed, &timeout);
+				if (ready == SOCKET_ERROR)
+				{
+					return WSAGetLastError();
+				}
+				if (ready == 0)
+				{
+					return WSAETIMEDOUT;
+				}
+
+				int length = sizeof(error);
+				if (getsockopt(connection, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) == SOCKET_ERROR)
+				{
+					return WSAGetLastError();
+				}
+				if (error != 0)
+				{
+					return error;
+				}
+			}
+
+			//Requests use blocking sends and receives bounded by SO_SNDTIMEO/SO_RCVTIMEO
+			u_long blocking = 0;
+			if (ioctlsocket(connection, FIONBIO, &blocking) == SOCKET_ERROR)
+			{
+				return WSAGetLastError();
+			}
+			return 0;
+		}
+
+		/*
+		* Method: connectHost
+		* Task: Open a new connection to the agent of a host
+		* Args: host - The host to connect to
+		* Return: The connected socket
+		*/
+		SOCKET connectHost(const Host& host)
+		{
+			addrinfo hints = {};
+			addrinfo* addresses = NULL;
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_protocol = IPPROTO_TCP;
+
+			int error = getaddrinfo(host.address.c_str(), std::to_string(host.port).c_str(), &hints, &addresses);
+			if (error != 0)
+			{
+				throw WinApiLastErrorException("getaddrinfo failed", error);
+			}
+
+			SOCKET connection = INVALID_SOCKET;
+			for (addrinfo* address = addresses; address != NULL && connection == INVALID_SOCKET; address = address->ai_next)
+			{
+				connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+				if (connection == INVALID_SOCKET)
+				{
+					continue;
+				}
+
+				if ((error = connectAddress(connection, address)) != 0)
+				{
+					closesocket(connection);
+					connection = INVALID_SOCKET;
+				}
+			}
+			freeaddrinfo(addresses);
+
+			if (connection == INVALID_SOCKET)
+			{
+				throw WinApiLastErrorException("connect failed", error);
+			}
+
+			DWORD timeout = _timeout;
+			BOOL no_delay = TRUE;
+			setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+			setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+			setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+
+			try
+			{
+				authenticate(connection);
+			}
+			catch (...)
+			{
+				closesocket(connection);
+				throw;
+			}
+
+			return connection;
+		}
+
+		/*
+		* Method: authenticate
+		* Task: Read the greeting of the agent and prove the shared secret if the agent asks for it
+		* Args: connection - A new connection to the agent
+		* Return: None
+		*/
+		void authenticate(SOCKET connection)
+		{
+			static const std::string HELLO = "HELLO";
+			std::string line;
+
+			if (!RemoteProtocol::receiveLine(connection, line) || line.compare(0, HELLO.size(), HELLO) != 0)
+			{
+				throw WinApiLastErrorException("The agent didn't greet", ERROR_INVALID_DATA);
+			}
+
+			//No nonce - the agent requires no secret
+			if (line.size() <= HELLO.size() + 1)
+			{
+				return;
+			}
+
+			if (_secret.empty())
+			{
+				throw WinApiLastErrorException("The agent requires a secret", ERROR_ACCESS_DENIED);
+			}
+
+			std::string nonce = line.substr(HELLO.size() + 1);
+			RemoteProtocol::sendLine(connection, "AUTH " + RemoteProtocol::computeProof(_secret, nonce) + "\n");
+
+			RemoteProtocol::Reply reply;
+			if (!RemoteProtocol::receiveLine(connection, line) || !RemoteProtocol::parseReply(line, reply))
+			{
+				throw WinApiLastErrorException("The agent closed the connection", WSAECONNRESET);
+			}
+			if (!reply.succeeded)
+			{
+				throw WinApiLastErrorException(reply.message, reply.error);
+			}
+		}
+
+		/*
+		* Method: isIdle
+		* Task: Check a pooled connection is still open - an idle connection has nothing to read
+		*		unless the agent closed it
+		* Args: connection - The pooled connection
+		* Return: false if the connection is closed or broken
+		*/
+		static bool isIdle(SOCKET connection)
+		{
+			fd_set readable;
+			timeval immediate = { 0, 0 };
+
+			FD_ZERO(&readable);
+			FD_SET(connection, &readable);
+			return select(0, &readable, NULL, NULL, &immediate) == 0;
+		}
+
+		/*
+		* Method: acquire
+		* Task: Take a pooled connection to the host, dropping the ones the agent closed meanwhile
+		* Args: host - The host to connect to
+		* Return: An idle pooled connection, or INVALID_SOCKET if there is none
+		*/
+		SOCKET acquire(const Host& host)
+		{
+			std::lock_guard<std::mutex> guard(_poolLock);
+
+			std::vector<SOCKET>& idle = _pool[hostKey(host)];
+			while (!idle.empty())
+			{
+				SOCKET connection = idle.back();
+				idle.pop_back();
+
+				if (isIdle(connection))
+				{
+					return connection;
+				}
+				closesocket(connection);
+			}
+
+			return INVALID_SOCKET;
+		}
+
+		/*
+		* Method: release
+		* Task: Return a healthy connection to the pool, closes it if the pool of the host is full
+		* Args: host - The host the connection belongs to
+		*		connection - The connection to return
+		* Return: None
+		*/
+		void release(const Host& host, SOCKET connection)
+		{
+			{
+				std::lock_guard<std::mutex> guard(_poolLock);
+
+				std::vector<SOCKET>& idle = _pool[hostKey(host)];
+				if (idle.size() < _maxIdle)
+				{
+					idle.push_back(connection);
+					return;
+				}
+			}
+
+			closesocket(connection);
+		}
+
+		/*
+		* Method: receiveReply
+		* Task: Receive the reply to a sent request
+		* Args: connection - The connected socket
+		*		reply - Receives the parsed reply
+		* Return: None
+		*/
+		static void receiveReply(SOCKET connection, RemoteProtocol::Reply& reply)
+		{
+			std::string line;
+
+			if (!RemoteProtocol::receiveLine(connection, line))
+			{
+				throw WinApiLastErrorException("Agent closed the connection", WSAECONNRESET);
+			}
+
+			if (!RemoteProtocol::parseReply(line, reply))
+			{
+				throw WinApiLastErrorException("Malformed agent reply", ERROR_INVALID_DATA);
+			}
+		}
+
+		/*
+		* Method: execute
+		* Task: Execute a single request on a single host
+		* Args: host - The host to send the request to
+		*		request - The protocol line to send
+		* Return: The result of the request
+		*/
+		Result execute(const Host& host, const std::string& request)
+		{
+			Result result = { host, false, 0, 0, "", 0.0 };
+			RemoteProtocol::Reply reply;
+			auto begin = std::chrono::steady_clock::now();
+
+			try
+			{
+				SOCKET connection = acquire(host);
+				bool pooled = (connection != INVALID_SOCKET);
+
+				if (!pooled)
+				{
+					connection = connectHost(host);
+				}
+
+				//Only a request that was never sent is retried - a sent START or CONTROL may have executed already
+				try
+				{
+					RemoteProtocol::sendLine(connection, request);
+				}
+				catch (const WinApiLastErrorException&)
+				{
+					closesocket(connection);
+					if (!pooled)
+					{
+						throw;
+					}
+
+					connection = connectHost(host);
+					try
+					{
+						RemoteProtocol::sendLine(connection, request);
+					}
+					catch (...)
+					{
+						closesocket(connection);
+						throw;
+					}
+				}
+
+				try
+				{
+					receiveReply(connection, reply);
+				}
+				catch (...)
+				{
+					closesocket(connection);
+					throw;
+				}
+
+				release(host, connection);
+
+				result.succeeded = reply.succeeded;
+				result.state = reply.state;
+				result.error = reply.error;
+				result.message = reply.message;
+			}
+			catch (const WinApiLastErrorException& ex)
+			{
+				result.error = ex.lastErrorCode;
+				result.message = ex.what();
+			}
+
+			result.latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+			return result;
+		}
+
+		/*
+		* Method: fanOut
+		* Task: Execute a request on all hosts concurrently, at most _maxInFlight at a time
+		* Args: hosts - The hosts to send the request to
+		*		request - The request to send
+		* Return: The results, in the order of the hosts
+		*/
+		std::vector<Result> fanOut(const std::vector<Host>& hosts, const RemoteProtocol::Request& request)
+		{
+			std::vector<Result> results(hosts.size());
+			std::atomic<size_t> next(0);
+
+			if (!RemoteProtocol::isValidServiceName(request.service_name))
+			{
+				for (size_t index = 0; index < hosts.size(); ++index)
+				{
+					results[index] = { hosts[index], false, 0, ERROR_INVALID_NAME, "Invalid service name", 0.0 };
+				}
+				return results;
+			}
+
+			std::string line = RemoteProtocol::formatRequest(request);
+
+			auto worker = [&]()
+			{
+				for (size_t index = next++; index < hosts.size(); index = next++)
+				{
+					results[index] = execute(hosts[index], line);
+				}
+			};
+
+			//The calling thread is one of the workers
+			size_t count = std::min(_maxInFlight, hosts.size());
+			std::vector<std::thread> workers;
+			for (size_t i = 1; i < count; ++i)
+			{
+				workers.emplace_back(worker);
+			}
+			worker();
+
+			for (std::thread& thread : workers)
+			{
+				thread.join();
+			}
+
+			return results;
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct RemoteServiceController instances
+		* Args: max_in_flight - Maximum number of requests executing concurrently
+		*		max_idle_per_host - Maximum number of idle connections kept per host
+		*		timeout - Connect, send and receive timeout of a single request in milliseconds
+		*		secret - Shared secret of the agents (see AgentSecurity), empty only for agents allowing unauthenticated use
+		* Returns: Instance of RemoteServiceController
+		*/
+		explicit RemoteServiceController(size_t max_in_flight = 16, size_t max_idle_per_host = 2, unsigned long timeout = 60000,
+			const std::string& secret = "")
+			: _maxInFlight(max_in_flight ? max_in_flight : 1), _maxIdle(max_idle_per_host), _timeout(timeout), _secret(secret)
+		{}
+
+		/*
+		* Method: Destructor
+		* Task: Close all pooled connections
+		* Args: None
+		* Returns: None
+		*/
+		~RemoteServiceController()
+		{
+			for (auto& host : _pool)
+			{
+				for (SOCKET connection : host.second)
+				{
+					closesocket(connection);
+				}
+			}
+		}
+
+		RemoteServiceController(const RemoteServiceController&) = delete;
+		RemoteServiceController& operator=(const RemoteServiceController&) = delete;
+
+		/*
+		* Method groups: Control a service on many hosts
+		* Task: Start, stop, query or send a custom control code (128-255) to the service on every host.
+		*		Failures are reported per host in the results, they never throw.
+		*/
+		std::vector<Result> startService(const std::vector<Host>& hosts, const std::string& service_name)
+		{
+			return fanOut(hosts, { RemoteProtocol::Verb::START, service_name, 0 });
+		}
+		std::vector<Result> stopService(const std::vector<Host>& hosts, const std::string& service_name)
+		{
+			return fanOut(hosts, { RemoteProtocol::Verb::STOP, service_name, 0 });
+		}
+		std::vector<Result> queryService(const std::vector<Host>& hosts, const std::string& service_name)
+		{
+			return fanOut(hosts, { RemoteProtocol::Verb::QUERY, service_name, 0 });
+		}
+		std::vector<Result> sendControl(const std::vector<Host>& hosts, const std::string& service_name, unsigned long control_code)
+		{
+			return fanOut(hosts, { RemoteProtocol::Verb::CONTROL, service_name, control_code });
+		}
+	};
+}
+
+#endif /* REMOTE_SERVICE_CONTROLLER_HPP_ */
\ No newline at end of file
@@ -0,0 +1,417 @@
+#ifndef REMOTE_SERVICE_PROTOCOL_HPP_
+#define REMOTE_SERVICE_PROTOCOL_HPP_
+
+/*
+* WinSock2 must be included before Windows.h, include this header before any other library header
+* (or define WIN32_LEAN_AND_MEAN) when using the remote agent and controller.
+*/
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <Windows.h>
+#include <bcrypt.h>
+
+#include "WinApiLastErrorException.hpp"
+
+#include <sstream>
+#include <string>
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "bcrypt.lib")
+
+namespace WinServiceLib
+{
+	/*
+	* Line based protocol spoken between the RemoteServiceController and a RemoteServiceAgent.
+	* Greeting:	"HELLO [<nonce>]\n"	- sent by the agent on connect, with a nonce when it requires the shared secret
+	* Auth:		"AUTH <proof>\n"	- HMAC-SHA256 of the nonce keyed by the secret, answered by a reply
+	* Request:	"<VERB> <control_code> <service_name>\n"	- VERB is START, STOP, QUERY or CONTROL, the control code is 0
+	*												  unless CONTROL, the service name is the rest of the line
+	* Reply:	"OK <service_state>\n" or "ERR <error_code> <message>\n"
+	* A connection carries any number of request/reply pairs, one at a time.
+	* The secret authenticates the controller, the traffic itself is not encrypted.
+	*/
+	namespace RemoteProtocol
+	{
+		/* Maximum length of a single request or reply line */
+		static const size_t MAX_LINE_LENGTH = 1024;
+
+		/* Maximum length of a service name, as accepted by the SCM */
+		static const size_t MAX_SERVICE_NAME_LENGTH = 256;
+
+		enum class Verb
+		{
+			START,
+			STOP,
+			QUERY,
+			CONTROL
+		};
+
+		struct Request
+		{
+			Verb			verb;			//The requested operation
+			std::string		service_name;	//The service to operate on
+			unsigned long	control_code;	//The custom control code (CONTROL only)
+		};
+
+		struct Reply
+		{
+			bool			succeeded;		//Whether the request succeeded
+			unsigned long	state;			//The service state after the request (when succeeded)
+			unsigned long	error;			//The error code (when failed, 0 if unknown)
+			std::string		message;		//The error message (when failed)
+		};
+
+		/* Return the wire name of a verb */
+		inline const char* verbName(Verb verb)
+		{
+			switch (verb)
+			{
+			case Verb::START:	return "START";
+			case Verb::STOP:	return "STOP";
+			case Verb::QUERY:	return "QUERY";
+			case Verb::CONTROL:	return "CONTROL";
+			default:			return "";
+			}
+		}
+
+		/*
+		* Method: isValidServiceName
+		* Task: Check a service name can be carried by a request line - it may contain spaces,
+		*		but no new lines or other control characters which would inject another request
+		* Args: service_name - The name to check
+		* Return: true if the name is valid
+		*/
+		inline bool isValidServiceName(const std::string& service_name)
+		{
+			if (service_name.empty() || service_name.size() > MAX_SERVICE_NAME_LENGTH)
+			{
+				return false;
+			}
+
+			for (char c : service_name)
+			{
+				unsigned char code = static_cast<unsigned char>(c);
+				if (code < 0x20 || code == 0x7f)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/*
+		* Method: formatRequest
+		* Task: Serialize a request into a protocol line
+		* Args: request - The request to serialize
+		* Return: The protocol line, including the terminating new line
+		*/
+		inline std::string formatRequest(const Request& request)
+		{
+			if (!isValidServiceName(request.service_name))
+			{
+				throw WinApiLastErrorException("Invalid service name", ERROR_INVALID_NAME);
+			}
+
+			std::ostringstream line;
+			line << verbName(request.verb) << ' ' << (request.verb == Verb::CONTROL ? request.control_code : 0) << ' ' << request.service_name << '\n';
+			return line.str();
+		}
+
+		/*
+		* Method: parseRequest
+		* Task: Parse a protocol line into a request
+		* Args: line - The line to parse (without the new line)
+		*		request - Receives the parsed request
+		* Return: true if the line is a valid request
+		*/
+		inline bool parseRequest(const std::string& line, Request& request)
+		{
+			std::istringstream stream(line);
+			std::string verb;
+
+			if (!(stream >> verb >> request.control_code) || stream.get() != ' ')
+			{
+				return false;
+			}
+
+			//The name is the rest of the line, as is - it may contain spaces
+			std::getline(stream, request.service_name);
+			if (!isValidServiceName(request.service_name))
+			{
+				return false;
+			}
+
+			if (verb == "START")		request.verb = Verb::START;
+			else if (verb == "STOP")	request.verb = Verb::STOP;
+			else if (verb == "QUERY")	request.verb = Verb::QUERY;
+			else if (verb == "CONTROL")	request.verb = Verb::CONTROL;
+			else
+			{
+				return false;
+			}
+
+			if (request.verb != Verb::CONTROL && request.control_code != 0)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		/*
+		* Method: formatReply
+		* Task: Serialize a reply into a protocol line
+		* Args: reply - The reply to serialize
+		* Return: The protocol line, including the terminating new line
+		*/
+		inline std::string formatReply(const Reply& reply)
+		{
+			std::ostringstream line;
+			if (reply.succeeded)
+			{
+				line << "OK " << reply.state;
+			}
+			else
+			{
+				//Messages are single line by definition of the protocol
+				std::string message = reply.message;
+				for (char& c : message)
+				{
+					if (c == '\n' || c == '\r') c = ' ';
+				}
+				line << "ERR " << reply.error << ' ' << message;
+			}
+			line << '\n';
+			return line.str();
+		}
+
+		/*
+		* Method: parseReply
+		* Task: Parse a protocol line into a reply
+		* Args: line - The line to parse (without the new line)
+		*		reply - Receives the parsed reply
+		* Return: true if the line is a valid reply
+		*/
+		inline bool parseReply(const std::string& line, Reply& reply)
+		{
+			std::istringstream stream(line);
+			std::string status;
+
+			if (!(stream >> status))
+			{
+				return false;
+			}
+
+			reply.state = 0;
+			reply.error = 0;
+			reply.message.clear();
+
+			if (status == "OK")
+			{
+				reply.succeeded = true;
+				return static_cast<bool>(stream >> reply.state);
+			}
+
+			if (status == "ERR")
+			{
+				reply.succeeded = false;
+				if (!(stream >> reply.error))
+				{
+					return false;
+				}
+				std::getline(stream >> std::ws, reply.message);
+				return true;
+			}
+
+			return false;
+		}
+
+		/* Return the lower case hexadecimal form of bytes */
+		inline std::string toHex(const unsigned char* bytes, size_t length)
+		{
+			static const char digits[] = "0123456789abcdef";
+			std::string hex;
+
+			for (size_t i = 0; i < length; ++i)
+			{
+				hex += digits[bytes[i] >> 4];
+				hex += digits[bytes[i] & 0x0f];
+			}
+			return hex;
+		}
+
+		/*
+		* Method: createNonce
+		* Task: Create a random challenge for the authentication of a connection
+		* Args: None
+		* Return: 128 random bits in hexadecimal form
+		*/
+		inline std::string createNonce()
+		{
+			unsigned char bytes[16];
+
+			NTSTATUS status = BCryptGenRandom(NULL, bytes, sizeof(bytes), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+			if (!BCRYPT_SUCCESS(status))
+			{
+				throw WinApiLastErrorException("BCryptGenRandom failed", static_cast<unsigned int>(status));
+			}
+
+			return toHex(bytes, sizeof(bytes));
+		}
+
+		/*
+		* Method: computeProof
+		* Task: Compute the proof of the shared secret for a challenge
+		* Args: secret - The shared secret
+		*		nonce - The challenge sent by the agent
+		* Return: HMAC-SHA256 of the nonce keyed by the secret, in hexadecimal form
+		*/
+		inline std::string computeProof(const std::string& secret, const std::string& nonce)
+		{
+			BCRYPT_ALG_HANDLE algorithm = NULL;
+			BCRYPT_HASH_HANDLE hash = NULL;
+			unsigned char digest[32];
+
+			NTSTATUS status = BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, NULL, BCRYPT_ALG_HANDLE_HMAC_FLAG);
+			if (BCRYPT_SUCCESS(status))
+			{
+				status = BCryptCreateHash(algorithm, &hash, NULL, 0,
+					reinterpret_cast<PUCHAR>(const_cast<char*>(secret.data())), static_cast<ULONG>(secret.size()), 0);
+			}
+			if (BCRYPT_SUCCESS(status))
+			{
+				status = BCryptHashData(hash, reinterpret_cast<PUCHAR>(const_cast<char*>(nonce.data())), static_cast<ULONG>(nonce.size()), 0);
+			}
+			if (BCRYPT_SUCCESS(status))
+			{
+				status = BCryptFinishHash(hash, digest, sizeof(digest), 0);
+			}
+
+			if (hash)
+			{
+				BCryptDestroyHash(hash);
+			}
+			if (algorithm)
+			{
+				BCryptCloseAlgorithmProvider(algorithm, 0);
+			}
+
+			if (!BCRYPT_SUCCESS(status))
+			{
+				throw WinApiLastErrorException("HMAC-SHA256 failed", static_cast<unsigned int>(status));
+			}
+
+			return toHex(digest, sizeof(digest));
+		}
+
+		/* Compare two proofs in time independent of their content */
+		inline bool equalProofs(const std::string& left, const std::string& right)
+		{
+			if (left.size() != right.size())
+			{
+				return false;
+			}
+
+			unsigned char difference = 0;
+			for (size_t i = 0; i < left.size(); ++i)
+			{
+				difference |= static_cast<unsigned char>(left[i] ^ right[i]);
+			}
+			return difference == 0;
+		}
+
+		/*
+		* Class: WinSockSession
+		* Task: RAII WSAStartup/WSACleanup pair - every object holding sockets owns one.
+		*/
+		class WinSockSession
+		{
+		public:
+			WinSockSession()
+			{
+				WSADATA data;
+				int error = WSAStartup(MAKEWORD(2, 2), &data);
+				if (error != 0)
+				{
+					throw WinApiLastErrorException("WSAStartup failed", error);
+				}
+			}
+
+			~WinSockSession()
+			{
+				WSACleanup();
+			}
+
+			WinSockSession(const WinSockSession&) = delete;
+			WinSockSession& operator=(const WinSockSession&) = delete;
+		};
+
+		/*
+		* Method: sendLine
+		* Task: Send a full protocol line on a connected socket
+		* Args: socket - The connected socket
+		*		line - The line to send, including the new line
+		* Return: None
+		*/
+		inline void sendLine(SOCKET socket, const std::string& line)
+		{
+			size_t sent = 0;
+			while (sent < line.size())
+			{
+				int result = send(socket, line.data() + sent, static_cast<int>(line.size() - sent), 0);
+				if (result == SOCKET_ERROR)
+				{
+					throw WinApiLastErrorException("send failed", WSAGetLastError());
+				}
+				sent += static_cast<size_t>(result);
+			}
+		}
+
+		/*
+		* Method: receiveLine
+		* Task: Receive a full protocol line from a connected socket.
+		*		The protocol is strictly request/reply so nothing follows the new line.
+		* Args: socket - The connected socket
+		*		line - Receives the line without the new line
+		* Return: false if the peer closed the connection before a line was received
+		*/
+		inline bool receiveLine(SOCKET socket, std::string& line)
+		{
+			char buffer[256];
+			line.clear();
+
+			for (;;)
+			{
+				int result = recv(socket, buffer, sizeof(buffer), 0);
+				if (result == SOCKET_ERROR)
+				{
+					throw WinApiLastErrorException("recv failed", WSAGetLastError());
+				}
+				if (result == 0)
+				{
+					return false;
+				}
+
+				line.append(buffer, static_cast<size_t>(result));
+
+				size_t end = line.find('\n');
+				if (end != std::string::npos)
+				{
+					line.resize(end);
+					if (!line.empty() && line.back() == '\r')
+					{
+						line.pop_back();
+					}
+					return true;
+				}
+
+				if (line.size() > MAX_LINE_LENGTH)
+				{
+					throw WinApiLastErrorException("Protocol line too long", ERROR_INVALID_DATA);
+				}
+			}
+		}
+	}
+}
+
+#endif /* REMOTE_SERVICE_PROTOCOL_HPP_ */
\ No newline at end of file
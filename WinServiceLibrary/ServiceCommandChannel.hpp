@@ -0,0 +1,861 @@
+#ifndef SERVICE_COMMAND_CHANNEL_HPP_
+#define SERVICE_COMMAND_CHANNEL_HPP_
+
+#include "WinApiLastErrorException.hpp"
+
+#include <Windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* A message of the command channel. The payload points into the shared ring - zero copy - and is valid
+	* until the message is released.
+	*/
+	struct CommandMessage
+	{
+		unsigned long long	id;			//Request identifier, echoed by the reply
+		unsigned long		type;		//Application defined message type
+		const void*			payload;	//The payload, inside the ring
+		size_t				length;		//Length of the payload in bytes
+	};
+
+	namespace CommandChannel
+	{
+		/* Identifies an initialized channel mapping */
+		static const uint32_t MAGIC = 0x4C4E4843;	//"CHNL"
+
+		/* Number of empty polls before a consumer falls back to a blocking wait */
+		static const unsigned long SPIN_COUNT = 4000;
+
+		/* Messages are aligned to 16 bytes inside the ring, so a gap at the end of the ring always fits a padding record */
+		static const size_t ALIGNMENT = 16;
+
+		/* Type of the record filling the end of the ring when a message doesn't fit contiguously */
+		static const uint32_t PADDING = 0xFFFFFFFF;
+
+		/* Slot states */
+		static const long SLOT_FREE = 0;
+		static const long SLOT_CLAIMING = 1;
+		static const long SLOT_CONNECTED = 2;
+		static const long SLOT_DISCONNECTED = 3;	//The service stopped serving a misbehaving client
+
+		/*
+		* Header of every record in a ring
+		*/
+		struct RecordHeader
+		{
+			uint32_t	length;		//Length of the payload
+			uint32_t	type;		//Message type, PADDING for padding records
+			uint64_t	id;			//Request identifier
+		};
+
+		/*
+		* Control block of a single producer / single consumer ring. Positions are byte counters that only grow.
+		*/
+		struct RingHeader
+		{
+			alignas(64) std::atomic<uint64_t>	head;		//Written by the producer
+			alignas(64) std::atomic<uint64_t>	tail;		//Written by the consumer
+			alignas(64) std::atomic<long>		waiting;	//The consumer is blocked on its event
+			std::atomic<long>					blocked;	//The producer is blocked until the consumer makes room
+		};
+
+		/*
+		* A client connection - one request ring (client to service) and one response ring (service to client)
+		*/
+		struct Slot
+		{
+			alignas(64) std::atomic<long>		state;		//SLOT_FREE, SLOT_CLAIMING, SLOT_CONNECTED or SLOT_DISCONNECTED
+			std::atomic<unsigned long>			owner;		//Process identifier of the client
+			std::atomic<unsigned long>			generation;	//Incremented by every client connecting and every service reopening the channel
+			alignas(64) std::atomic<long>		serving;	//The service is reading the rings of the slot
+			RingHeader							request;	//Client to service
+			RingHeader							response;	//Service to client
+		};
+
+		/*
+		* Header of the channel mapping, followed by the slots and then by the ring buffers
+		*/
+		struct ChannelHeader
+		{
+			uint32_t							magic;			//MAGIC once the service initialized the mapping
+			uint32_t							slotCount;		//Number of client slots
+			uint64_t							ringSize;		//Size of every ring buffer, a power of 2
+			alignas(64) std::atomic<long>		serverWaiting;	//The service is blocked on its event
+		};
+
+		/* Round a length up to the record alignment */
+		inline size_t align(size_t length)
+		{
+			return (length + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		}
+
+		/* Return the size of the mapping of a channel */
+		inline size_t mappingSize(size_t slots, size_t ring_size)
+		{
+			return sizeof(ChannelHeader) + slots * sizeof(Slot) + slots * 2 * ring_size;
+		}
+
+		/* Return the slot array of a mapped channel */
+		inline Slot* slots(ChannelHeader* header)
+		{
+			return reinterpret_cast<Slot*>(reinterpret_cast<char*>(header) + sizeof(ChannelHeader));
+		}
+
+		/* Return the buffer of the request (direction 0) or response (direction 1) ring of a slot */
+		inline char* buffer(ChannelHeader* header, size_t slot, size_t direction)
+		{
+			char* base = reinterpret_cast<char*>(slots(header) + header->slotCount);
+			return base + (slot * 2 + direction) * header->ringSize;
+		}
+
+		/* Return the names of the mapping and the events of a channel */
+		inline std::string mappingName(const char* service_name)
+		{
+			return std::string("Global\\WinServiceLib.Channel.") + service_name;
+		}
+		inline std::string serverEventName(const char* service_name)
+		{
+			return mappingName(service_name) + ".Server";
+		}
+		inline std::string clientEventName(const char* service_name, size_t slot)
+		{
+			return mappingName(service_name) + ".Client." + std::to_string(slot);
+		}
+
+		/*
+		* Method: notify
+		* Task: Wake the consumer of a ring if it's blocked
+		* Args: waiting - The waiting flag of the consumer
+		*		event - The event the consumer blocks on
+		* Return: None
+		*/
+		inline void notify(std::atomic<long>& waiting, HANDLE event)
+		{
+			//Orders the published head before reading the flag, pairs with the fence in the consumer
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0))
+			{
+				SetEvent(event);
+			}
+		}
+
+		/*
+		* Single producer / single consumer ring view over shared memory.
+		* Records never wrap: when a record doesn't fit before the end of the buffer, a padding record fills the gap.
+		*/
+		class Ring
+		{
+		private:
+			RingHeader*		_header;		//The shared control block
+			char*			_buffer;		//The shared buffer
+			size_t			_size;			//Size of the buffer, a power of 2
+			size_t			_reserved;		//Producer - bytes reserved by the pending record, including padding
+			size_t			_padding;		//Producer - padding preceding the pending record
+
+			/* Throw on a record the other process corrupted */
+			static void corrupt()
+			{
+				throw WinApiLastErrorException("Corrupt command channel record", ERROR_INVALID_DATA);
+			}
+
+			/*
+			* Method: fits
+			* Task: Producer - check whether a record fits in the free part of the ring
+			* Args: length - Length of the payload
+			*		padding - Receives the padding needed before the record
+			* Return: false if the ring is too full
+			*/
+			bool fits(size_t length, size_t& padding) const
+			{
+				uint64_t head = _header->head.load(std::memory_order_relaxed);
+				uint64_t tail = _header->tail.load(std::memory_order_acquire);
+				size_t offset = static_cast<size_t>(head & (_size - 1));
+				size_t total = align(sizeof(RecordHeader) + length);
+
+				padding = (offset + total > _size) ? (_size - offset) : 0;
+				return _size - static_cast<size_t>(head - tail) >= padding + total;
+			}
+
+		public:
+			Ring()
+				: _header(NULL), _buffer(NULL), _size(0), _reserved(0), _padding(0)
+			{}
+
+			Ring(RingHeader* header, char* buffer, size_t size)
+				: _header(header), _buffer(buffer), _size(size), _reserved(0), _padding(0)
+			{}
+
+			/* Reset the ring - only while neither side uses it */
+			void reset()
+			{
+				_header->head.store(0);
+				_header->tail.store(0);
+				_header->waiting.store(0);
+				_header->blocked.store(0);
+			}
+
+			/* Return the largest payload a single record can carry */
+			size_t maxPayload() const
+			{
+				return _size / 2 - sizeof(RecordHeader);
+			}
+
+			/* Return whether the ring holds no record - reads the positions only */
+			bool isEmpty() const
+			{
+				return _header->tail.load(std::memory_order_acquire) == _header->head.load(std::memory_order_acquire);
+			}
+
+			/* Producer - return whether a record of the given length can be reserved now */
+			bool canReserve(size_t length) const
+			{
+				size_t padding;
+				return length <= maxPayload() && fits(length, padding);
+			}
+
+			/*
+			* Method: reserve
+			* Task: Producer - reserve room for a record, the payload is written in place
+			* Args: length - Length of the payload
+			* Return: Pointer to the payload inside the ring, NULL if the ring is full
+			*/
+			void* reserve(size_t length)
+			{
+				if (length > maxPayload())
+				{
+					throw WinApiLastErrorException("Command payload larger than the ring", ERROR_INVALID_PARAMETER);
+				}
+
+				size_t padding;
+				if (!fits(length, padding))
+				{
+					return NULL;
+				}
+
+				uint64_t head = _header->head.load(std::memory_order_relaxed);
+				size_t offset = static_cast<size_t>(head & (_size - 1));
+				size_t total = align(sizeof(RecordHeader) + length);
+
+				if (padding)
+				{
+					RecordHeader* pad = reinterpret_cast<RecordHeader*>(_buffer + offset);
+					pad->length = 0;
+					pad->type = PADDING;
+					pad->id = 0;
+					offset = 0;
+				}
+
+				_padding = padding;
+				_reserved = padding + total;
+				return _buffer + offset + sizeof(RecordHeader);
+			}
+
+			/*
+			* Method: commit
+			* Task: Producer - publish the reserved record
+			* Args: type - Message type
+			*		id - Request identifier
+			*		length - Length of the payload actually written, at most the reserved length
+			* Return: None
+			*/
+			void commit(unsigned long type, unsigned long long id, size_t length)
+			{
+				uint64_t head = _header->head.load(std::memory_order_relaxed);
+				size_t offset = static_cast<size_t>((head + _padding) & (_size - 1));
+
+				RecordHeader* record = reinterpret_cast<RecordHeader*>(_buffer + offset);
+				record->length = static_cast<uint32_t>(length);
+				record->type = static_cast<uint32_t>(type);
+				record->id = id;
+
+				//Publish padding, header and payload at once
+				_header->head.store(head + _padding + align(sizeof(RecordHeader) + length), std::memory_order_release);
+				_reserved = 0;
+				_padding = 0;
+			}
+
+			/*
+			* Method: peek
+			* Task: Consumer - return the oldest record without consuming it. The record is written by the other
+			*		process, so it's copied once and checked against the ring before it's used.
+			* Args: message - Receives the record, the payload points into the ring
+			* Return: false if the ring is empty, throws if the record is corrupt
+			*/
+			bool peek(CommandMessage& message)
+			{
+				for (;;)
+				{
+					uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+					uint64_t head = _header->head.load(std::memory_order_acquire);
+					if (tail == head)
+					{
+						return false;
+					}
+
+					size_t available = static_cast<size_t>(head - tail);
+					size_t offset = static_cast<size_t>(tail & (_size - 1));
+					RecordHeader record;
+					memcpy(&record, _buffer + offset, sizeof(record));
+
+					if (record.type == PADDING)
+					{
+						if (available < _size - offset)
+						{
+							corrupt();
+						}
+						_header->tail.store(tail + (_size - offset), std::memory_order_release);
+						continue;
+					}
+
+					size_t total = align(sizeof(RecordHeader) + record.length);
+					if (record.length > maxPayload() || total > available || offset + total > _size)
+					{
+						corrupt();
+					}
+
+					message.id = record.id;
+					message.type = record.type;
+					message.length = record.length;
+					message.payload = _buffer + offset + sizeof(RecordHeader);
+					return true;
+				}
+			}
+
+			/*
+			* Method: release
+			* Task: Consumer - consume the record returned by peek, its payload must not be used anymore
+			* Args: message - The record returned by peek
+			* Return: None
+			*/
+			void release(const CommandMessage& message)
+			{
+				uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+				_header->tail.store(tail + align(sizeof(RecordHeader) + message.length), std::memory_order_release);
+			}
+
+			/*
+			* Method: wait
+			* Task: Consumer - block until the ring is not empty or the timeout expires. Spins before blocking.
+			* Args: waiting - The waiting flag the producer checks
+			*		event - The event the producer signals
+			*		timeout - Maximum time to block in milliseconds
+			* Return: false if the ring is still empty
+			*/
+			bool wait(std::atomic<long>& waiting, HANDLE event, unsigned long timeout)
+			{
+				CommandMessage message;
+
+				for (unsigned long spin = 0; spin < SPIN_COUNT; ++spin)
+				{
+					if (peek(message))
+					{
+						return true;
+					}
+					YieldProcessor();
+				}
+
+				waiting.store(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!peek(message))
+				{
+					WaitForSingleObject(event, timeout);
+				}
+				waiting.store(0);
+
+				return peek(message);
+			}
+		};
+	}
+
+	class ServiceCommandServer;
+
+	/*
+	* Reply of a command - written directly into the response ring of the requesting client
+	*/
+	class CommandReply
+	{
+	private:
+		friend class ServiceCommandServer;
+
+		CommandChannel::Ring&	_ring;		//The response ring of the client
+		unsigned long long		_id;		//The request identifier
+		std::vector<char>&		_staging;	//Holds the reply when the response ring is full
+		bool					_staged;	//Whether the reply was written to _staging
+		bool					_sent;		//Whether the reply was committed
+		unsigned long			_type;		//Type of a staged reply
+		size_t					_length;	//Length of a staged reply
+
+	public:
+		CommandReply(CommandChannel::Ring& ring, unsigned long long id, std::vector<char>& staging)
+			: _ring(ring), _id(id), _staging(staging), _staged(false), _sent(false), _type(0), _length(0)
+		{}
+
+		/*
+		* Method: reserve
+		* Task: Reserve room for the reply payload in the response ring - zero copy. Never waits: when the client
+		*		didn't consume earlier replies, the reply is staged and delivered once the client made room.
+		* Args: length - Maximum length of the payload
+		* Return: Pointer to the payload
+		*/
+		void* reserve(size_t length)
+		{
+			void* payload = _ring.reserve(length);
+			if (payload == NULL)
+			{
+				_staging.resize(length ? length : 1);
+				_staged = true;
+				payload = _staging.data();
+			}
+			return payload;
+		}
+
+		/* Publish the reserved reply */
+		void commit(unsigned long type, size_t length)
+		{
+			if (_staged)
+			{
+				_type = type;
+				_length = length;
+			}
+			else
+			{
+				_ring.commit(type, _id, length);
+			}
+			_sent = true;
+		}
+
+		/* Copy and publish a reply */
+		void send(unsigned long type, const void* data, size_t length)
+		{
+			void* payload = reserve(length);
+			if (length)
+			{
+				memcpy(payload, data, length);
+			}
+			commit(type, length);
+		}
+
+		/* Return whether a reply was published */
+		bool isSent() const
+		{
+			return _sent;
+		}
+	};
+
+	/*
+	* Service side of the command channel - a thread serving the request rings of all connected clients.
+	* Requests of a client are drained in batches, and its replies are signaled once per batch.
+	* A client whose response ring is full is woken and skipped until it consumed its replies, so it never
+	* stalls the other clients; a client writing corrupt records is disconnected.
+	*/
+	class ServiceCommandServer
+	{
+	public:
+		typedef std::function<void(const CommandMessage&, CommandReply&)> Handler;
+
+	private:
+		/* Maximum time the server blocks before checking it should stop, in milliseconds */
+		static const unsigned long IDLE_WAIT = 200;
+
+		/*
+		* A reply waiting for room in the response ring of its client
+		*/
+		struct StagedReply
+		{
+			bool				pending;	//Whether the reply wasn't delivered yet
+			unsigned long		type;		//Type of the reply
+			unsigned long long	id;			//The request identifier
+			size_t				length;		//Length of the reply
+			unsigned long		generation;	//Generation of the slot when the reply was staged
+			std::vector<char>	data;		//The payload
+
+			StagedReply()
+				: pending(false), type(0), id(0), length(0), generation(0)
+			{}
+		};
+
+		HANDLE								_mapping;		//The channel mapping
+		CommandChannel::ChannelHeader*		_header;		//The mapped channel
+		HANDLE								_serverEvent;	//Signaled by clients when the server is blocked
+		std::vector<HANDLE>					_clientEvents;	//Signaled by the server when a client is blocked
+		std::vector<CommandChannel::Ring>	_requests;		//Request rings, consumed by the server
+		std::vector<CommandChannel::Ring>	_responses;		//Response rings, produced by the server
+		std::vector<StagedReply>			_staged;		//Replies waiting for room, by slot
+		std::atomic<bool>					_running;		//Whether the server thread should keep running
+		std::thread							_thread;		//The server thread
+		Handler								_handler;		//Handles the requests
+
+		/* Create a named auto-reset event */
+		static HANDLE createEvent(const std::string& name)
+		{
+			HANDLE event = CreateEvent(NULL, FALSE, FALSE, name.c_str());
+			if (event == NULL)
+			{
+				throw WinApiLastErrorException("Command channel CreateEvent failed", GetLastError());
+			}
+			return event;
+		}
+
+		/*
+		* Method: drainSlot
+		* Task: Deliver the staged reply of a client, then handle its pending requests until a reply has to be staged
+		* Args: index - The slot of the client
+		* Return: true if requests were handled or a staged reply delivered
+		*/
+		bool drainSlot(size_t index)
+		{
+			CommandChannel::Slot& slot = CommandChannel::slots(_header)[index];
+			StagedReply& staged = _staged[index];
+			unsigned long generation = slot.generation.load();
+			CommandMessage request;
+			bool served = false;
+
+			//A reply staged for a previous client of the slot is dropped
+			if (staged.pending && staged.generation != generation)
+			{
+				staged.pending = false;
+			}
+
+			if (staged.pending)
+			{
+				void* payload = _responses[index].reserve(staged.length);
+				if (payload == NULL)
+				{
+					//Still full - the client wakes the server when it consumed a reply
+					slot.response.blocked.store(1);
+					return false;
+				}
+
+				if (staged.length)
+				{
+					memcpy(payload, staged.data.data(), staged.length);
+				}
+				_responses[index].commit(staged.type, staged.id, staged.length);
+				staged.pending = false;
+				served = true;
+			}
+
+			while (_requests[index].peek(request))
+			{
+				CommandReply reply(_responses[index], request.id, staged.data);
+
+				try
+				{
+					_handler(request, reply);
+				}
+				catch (...)
+				{
+					//Failed commands are answered with an empty reply of the request type
+				}
+
+				if (!reply.isSent())
+				{
+					reply.send(request.type, NULL, 0);
+				}
+
+				_requests[index].release(request);
+				served = true;
+
+				//The response ring is full - stop draining the client until it consumed its replies
+				if (reply._staged)
+				{
+					staged.pending = true;
+					staged.type = reply._type;
+					staged.id = request.id;
+					staged.length = reply._length;
+					staged.generation = generation;
+					slot.response.blocked.store(1);
+					break;
+				}
+			}
+
+			if (served)
+			{
+				//Replies arrived and requests were consumed - wake the client waiting for either
+				CommandChannel::notify(slot.response.waiting, _clientEvents[index]);
+				CommandChannel::notify(slot.request.blocked, _clientEvents[index]);
+			}
+
+			return served;
+		}
+
+		/*
+		* Method: serveSlot
+		* Task: Handle all pending requests of a client. The slot is marked served meanwhile, so a client
+		*		reclaiming it waits before resetting the rings.
+		* Args: index - The slot of the client
+		* Return: true if requests were handled
+		*/
+		bool serveSlot(size_t index)
+		{
+			CommandChannel::Slot& slot = CommandChannel::slots(_header)[index];
+			bool served = false;
+
+			if (slot.state.load(std::memory_order_acquire) != CommandChannel::SLOT_CONNECTED)
+			{
+				return false;
+			}
+
+			//Pairs with the claim of the slot, which waits while serving is set
+			slot.serving.store(1);
+			if (slot.state.load() == CommandChannel::SLOT_CONNECTED)
+			{
+				try
+				{
+					served = drainSlot(index);
+				}
+				catch (const WinApiLastErrorException&)
+				{
+					//The client corrupted its request ring
+					long connected = CommandChannel::SLOT_CONNECTED;
+					slot.state.compare_exchange_strong(connected, CommandChannel::SLOT_DISCONNECTED);
+					_staged[index].pending = false;
+
+					//A client blocked on the channel sees it's disconnected
+					SetEvent(_clientEvents[index]);
+				}
+			}
+			slot.serving.store(0);
+
+			return served;
+		}
+
+		/* Return whether a client has work the server can do now - reads the ring positions only */
+		bool hasWork(size_t index)
+		{
+			if (CommandChannel::slots(_header)[index].state.load() != CommandChannel::SLOT_CONNECTED)
+			{
+				return false;
+			}
+
+			const StagedReply& staged = _staged[index];
+			return staged.pending ? _responses[index].canReserve(staged.length) : !_requests[index].isEmpty();
+		}
+
+		/* The server thread */
+		void serve()
+		{
+			unsigned long idle = 0;
+
+			while (_running)
+			{
+				bool served = false;
+				for (size_t index = 0; index < _header->slotCount; ++index)
+				{
+					served |= serveSlot(index);
+				}
+
+				if (served)
+				{
+					idle = 0;
+					continue;
+				}
+
+				if (++idle < CommandChannel::SPIN_COUNT)
+				{
+					YieldProcessor();
+					continue;
+				}
+
+				//Idle - block until a client flushes a request
+				_header->serverWaiting.store(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				bool pending = false;
+				for (size_t index = 0; index < _header->slotCount && !pending; ++index)
+				{
+					pending = hasWork(index);
+				}
+
+				if (!pending)
+				{
+					WaitForSingleObject(_serverEvent, IDLE_WAIT);
+				}
+				_header->serverWaiting.store(0);
+				idle = 0;
+			}
+		}
+
+	public:
+		ServiceCommandServer()
+			: _mapping(NULL), _header(NULL), _serverEvent(NULL), _running(false)
+		{}
+
+		~ServiceCommandServer()
+		{
+			close();
+		}
+
+		ServiceCommandServer(const ServiceCommandServer&) = delete;
+		ServiceCommandServer& operator=(const ServiceCommandServer&) = delete;
+
+		/*
+		* Method: open
+		* Task: Create the channel of a service. Call start to serve it.
+		* Args: service_name - The name of the service
+		*		slot_count - Maximum number of connected clients
+		*		ring_size - Size of every ring buffer in bytes, rounded up to a power of 2
+		*		handler - Handles the requests
+		* Return: None
+		*/
+		void open(const char* service_name, size_t slot_count, size_t ring_size, Handler handler)
+		{
+			close();
+
+			//Both processes access the ring positions with atomics, which must not fall back to locks
+			if (!std::atomic<uint64_t>().is_lock_free())
+			{
+				throw WinApiLastErrorException("The command channel requires lock-free 64 bit atomics", ERROR_NOT_SUPPORTED);
+			}
+
+			size_t size = 4096;
+			while (size < ring_size)
+			{
+				size <<= 1;
+			}
+
+			unsigned long long mapping_size = CommandChannel::mappingSize(slot_count, size);
+			_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, static_cast<DWORD>(mapping_size >> 32),
+				static_cast<DWORD>(mapping_size), CommandChannel::mappingName(service_name).c_str());
+			if (_mapping == NULL)
+			{
+				throw WinApiLastErrorException("Command channel CreateFileMapping failed", GetLastError());
+			}
+			bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+			_header = static_cast<CommandChannel::ChannelHeader*>(MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+			if (_header == NULL)
+			{
+				unsigned long error = GetLastError();
+				close();
+				throw WinApiLastErrorException("Command channel MapViewOfFile failed", error);
+			}
+
+			//Clients of a previous instance keep its mapping alive, with the size it was created with
+			MEMORY_BASIC_INFORMATION region;
+			if (existed && (VirtualQuery(_header, &region, sizeof(region)) == 0 || region.RegionSize < mapping_size))
+			{
+				//Leave the mapping of the previous instance untouched
+				UnmapViewOfFile(_header);
+				_header = NULL;
+				close();
+				throw WinApiLastErrorException("A smaller command channel of the service is still mapped", ERROR_ALREADY_EXISTS);
+			}
+
+			try
+			{
+				_serverEvent = createEvent(CommandChannel::serverEventName(service_name));
+				for (size_t index = 0; index < slot_count; ++index)
+				{
+					_clientEvents.push_back(createEvent(CommandChannel::clientEventName(service_name, index)));
+				}
+			}
+			catch (const std::exception&)
+			{
+				close();
+				throw;
+			}
+
+			//A previous instance of the service may have left clients connected - drop them. The generations keep
+			//growing, so a client of the previous instance sees its slot was taken even if the slot is claimed again.
+			_header->magic = 0;
+			_header->slotCount = static_cast<uint32_t>(slot_count);
+			_header->ringSize = size;
+			_header->serverWaiting.store(0);
+
+			for (size_t index = 0; index < slot_count; ++index)
+			{
+				CommandChannel::Slot& slot = CommandChannel::slots(_header)[index];
+				slot.state.store(CommandChannel::SLOT_FREE);
+				slot.owner.store(0);
+				slot.generation.fetch_add(1);
+				slot.serving.store(0);
+
+				_requests.emplace_back(&slot.request, CommandChannel::buffer(_header, index, 0), size);
+				_responses.emplace_back(&slot.response, CommandChannel::buffer(_header, index, 1), size);
+				_requests.back().reset();
+				_responses.back().reset();
+			}
+			_staged.resize(slot_count);
+
+			std::atomic_thread_fence(std::memory_order_release);
+			_header->magic = CommandChannel::MAGIC;
+			_handler = handler;
+		}
+
+		/*
+		* Method: start
+		* Task: Serve the channel on the given thread
+		* Args: thread_factory - Creates the server thread from its function (e.g. BaseService::createThread)
+		* Return: None
+		*/
+		template <typename ThreadFactory>
+		void start(ThreadFactory thread_factory)
+		{
+			_running = true;
+			_thread = thread_factory([this]() { serve(); });
+		}
+
+		/*
+		* Method: close
+		* Task: Stop serving and release the channel. Connected clients see the magic cleared, blocked ones are woken.
+		* Args: None
+		* Return: None
+		*/
+		void close()
+		{
+			_running = false;
+			if (_thread.joinable())
+			{
+				SetEvent(_serverEvent);
+				_thread.join();
+			}
+
+			if (_header)
+			{
+				_header->magic = 0;
+				UnmapViewOfFile(_header);
+				_header = NULL;
+			}
+
+			for (HANDLE event : _clientEvents)
+			{
+				SetEvent(event);
+				CloseHandle(event);
+			}
+			_clientEvents.clear();
+			_requests.clear();
+			_responses.clear();
+			_staged.clear();
+
+			if (_serverEvent)
+			{
+				CloseHandle(_serverEvent);
+				_serverEvent = NULL;
+			}
+
+			if (_mapping)
+			{
+				CloseHandle(_mapping);
+				_mapping = NULL;
+			}
+		}
+
+		/* Return whether the channel is open */
+		bool isOpen() const
+		{
+			return _header != NULL;
+		}
+	};
+}
+
+#endif /* SERVICE_COMMAND_CHANNEL_HPP_ */
\ No newline at end of file
@@ -0,0 +1,419 @@
+#ifndef SERVICE_COMMAND_CLIENT_HPP_
+#define SERVICE_COMMAND_CLIENT_HPP_
+
+#include "ServiceCommandChannel.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Controller side of the command channel of a running service.
+	* Every client owns a slot of the channel - a request ring and a response ring - so many clients
+	* (in one or many processes) can talk to the service concurrently. A client object is used by one thread at a time.
+	*
+	* Requests can be batched: post() several requests and flush() once to wake the service.
+	* Payloads are zero copy in both directions: reserve()/commit() write requests in place and
+	* receive() returns replies in place until release().
+	*/
+	class ServiceCommandClient
+	{
+	private:
+		HANDLE							_mapping;		//The channel mapping
+		CommandChannel::ChannelHeader*	_header;		//The mapped channel
+		HANDLE							_serverEvent;	//Wakes the service
+		HANDLE							_clientEvent;	//Signaled by the service when replies arrive
+		size_t							_slot;			//The slot owned by the client
+		unsigned long					_generation;	//Generation of the slot when the client claimed it
+		uint32_t						_slotCount;		//Layout of the channel when the client connected
+		uint64_t						_ringSize;
+		CommandChannel::Ring			_requests;		//Produced by the client
+		CommandChannel::Ring			_responses;		//Consumed by the client
+		unsigned long long				_nextId;		//Identifier of the next request
+		CommandMessage					_received;		//The reply returned by receive, until released
+		bool							_holding;		//Whether _received must be released
+
+		/* Return whether the process owning a slot exited */
+		static bool isOwnerDead(unsigned long process_id)
+		{
+			HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, process_id);
+			if (process == NULL)
+			{
+				//Only a missing process is dead - a process of another user is denied, not gone
+				return GetLastError() == ERROR_INVALID_PARAMETER;
+			}
+
+			bool dead = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+			CloseHandle(process);
+			return dead;
+		}
+
+		/*
+		* Method: claimSlot
+		* Task: Take a free slot, or the slot of a client whose process exited. Waits until the service
+		*		stopped reading the rings of the slot, so they can be reset.
+		* Args: None
+		* Return: The index of the claimed slot
+		*/
+		size_t claimSlot()
+		{
+			CommandChannel::Slot* slots = CommandChannel::slots(_header);
+
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				for (size_t index = 0; index < _header->slotCount; ++index)
+				{
+					long expected = CommandChannel::SLOT_FREE;
+
+					//Second pass - reclaim slots of crashed clients
+					long state = slots[index].state.load();
+					if (pass == 1 && (state == CommandChannel::SLOT_CONNECTED || state == CommandChannel::SLOT_DISCONNECTED) &&
+						isOwnerDead(slots[index].owner.load()))
+					{
+						expected = state;
+					}
+
+					if (slots[index].state.compare_exchange_strong(expected, CommandChannel::SLOT_CLAIMING))
+					{
+						//Pairs with the service, which marks the slot served before checking it's connected
+						while (slots[index].serving.load())
+						{
+							std::this_thread::yield();
+						}
+						return index;
+					}
+				}
+			}
+
+			throw WinApiLastErrorException("All command channel slots are in use", ERROR_BUSY);
+		}
+
+		/* Return whether the slot still belongs to the client, in the layout the client connected to */
+		bool ownsSlot() const
+		{
+			return _header && _header->slotCount == _slotCount && _header->ringSize == _ringSize && _slot < _slotCount &&
+				CommandChannel::slots(_header)[_slot].generation.load() == _generation;
+		}
+
+		/* Release the shared resources */
+		void close()
+		{
+			//A stale client must not free the slot of the client that took it over
+			if (ownsSlot())
+			{
+				CommandChannel::slots(_header)[_slot].state.store(CommandChannel::SLOT_FREE);
+			}
+
+			if (_header)
+			{
+				UnmapViewOfFile(_header);
+				_header = NULL;
+			}
+
+			if (_clientEvent)
+			{
+				CloseHandle(_clientEvent);
+				_clientEvent = NULL;
+			}
+
+			if (_serverEvent)
+			{
+				CloseHandle(_serverEvent);
+				_serverEvent = NULL;
+			}
+
+			if (_mapping)
+			{
+				CloseHandle(_mapping);
+				_mapping = NULL;
+			}
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Connect to the command channel of a running service
+		* Args: service_name - The name of the service
+		* Returns: Instance of ServiceCommandClient
+		*/
+		explicit ServiceCommandClient(const char* service_name)
+			: _mapping(NULL), _header(NULL), _serverEvent(NULL), _clientEvent(NULL), _slot(static_cast<size_t>(-1)),
+			_generation(0), _slotCount(0), _ringSize(0), _nextId(1), _received(), _holding(false)
+		{
+			try
+			{
+				_mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, CommandChannel::mappingName(service_name).c_str());
+				if (_mapping == NULL)
+				{
+					throw WinApiLastErrorException("The service exposes no command channel", GetLastError());
+				}
+
+				_header = static_cast<CommandChannel::ChannelHeader*>(MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+				if (_header == NULL)
+				{
+					throw WinApiLastErrorException("Command channel MapViewOfFile failed", GetLastError());
+				}
+
+				if (_header->magic != CommandChannel::MAGIC)
+				{
+					throw WinApiLastErrorException("The command channel is not ready", ERROR_INVALID_STATE);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				_slotCount = _header->slotCount;
+				_ringSize = _header->ringSize;
+
+				_serverEvent = OpenEvent(EVENT_MODIFY_STATE, FALSE, CommandChannel::serverEventName(service_name).c_str());
+				if (_serverEvent == NULL)
+				{
+					throw WinApiLastErrorException("Command channel OpenEvent failed", GetLastError());
+				}
+
+				_slot = claimSlot();
+
+				_clientEvent = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, CommandChannel::clientEventName(service_name, _slot).c_str());
+				if (_clientEvent == NULL)
+				{
+					unsigned long error = GetLastError();
+					CommandChannel::slots(_header)[_slot].state.store(CommandChannel::SLOT_FREE);
+					_slot = static_cast<size_t>(-1);
+					throw WinApiLastErrorException("Command channel OpenEvent failed", error);
+				}
+			}
+			catch (const std::exception&)
+			{
+				close();
+				throw;
+			}
+
+			CommandChannel::Slot& slot = CommandChannel::slots(_header)[_slot];
+			size_t ring_size = static_cast<size_t>(_header->ringSize);
+
+			_requests = CommandChannel::Ring(&slot.request, CommandChannel::buffer(_header, _slot, 0), ring_size);
+			_responses = CommandChannel::Ring(&slot.response, CommandChannel::buffer(_header, _slot, 1), ring_size);
+
+			//The service skips slots that are not connected, so the rings can be reset safely
+			_requests.reset();
+			_responses.reset();
+			ResetEvent(_clientEvent);
+
+			slot.owner.store(GetCurrentProcessId());
+			_generation = slot.generation.fetch_add(1) + 1;
+			slot.state.store(CommandChannel::SLOT_CONNECTED, std::memory_order_release);
+		}
+
+		/*
+		* Method: Destructor
+		* Task: Disconnect from the channel
+		* Args: None
+		* Returns: None
+		*/
+		~ServiceCommandClient()
+		{
+			close();
+		}
+
+		ServiceCommandClient(const ServiceCommandClient&) = delete;
+		ServiceCommandClient& operator=(const ServiceCommandClient&) = delete;
+
+		/*
+		* Method: isConnected
+		* Task: Check the service still serves the channel and the slot is still the client's. A restarted service
+		*		may reuse the mapping of its previous instance - with another layout, or with the slot given to another client.
+		* Args: None
+		* Return: false if the client must not use the rings anymore
+		*/
+		bool isConnected() const
+		{
+			return _header && _header->magic == CommandChannel::MAGIC && ownsSlot() &&
+				CommandChannel::slots(_header)[_slot].state.load() == CommandChannel::SLOT_CONNECTED;
+		}
+
+		/* Throw if the client must not use the rings anymore */
+		void checkConnected() const
+		{
+			if (!isConnected())
+			{
+				throw WinApiLastErrorException("The service closed the command channel", ERROR_INVALID_STATE);
+			}
+		}
+
+		/*
+		* Method: reserve
+		* Task: Reserve room for a request payload in the request ring - zero copy. While the ring is full the client
+		*		wakes the service and blocks until the service consumed requests.
+		* Args: length - Maximum length of the payload
+		*		timeout - Maximum time to wait for room in milliseconds
+		* Return: Pointer to the payload, valid until commit. NULL if the ring stayed full.
+		*/
+		void* reserve(size_t length, unsigned long timeout = INFINITE)
+		{
+			checkConnected();
+
+			CommandChannel::Slot& slot = CommandChannel::slots(_header)[_slot];
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+			void* payload;
+
+			while ((payload = _requests.reserve(length)) == NULL)
+			{
+				unsigned long remaining = timeout;
+				if (timeout != INFINITE)
+				{
+					auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+					if (left <= 0)
+					{
+						return NULL;
+					}
+					remaining = static_cast<unsigned long>(left);
+				}
+
+				//The service may be blocked while the ring is full of posted requests
+				flush();
+
+				//Pairs with the service, which consumes requests before checking the flag
+				slot.request.blocked.store(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!_requests.canReserve(length))
+				{
+					WaitForSingleObject(_clientEvent, remaining);
+				}
+				slot.request.blocked.store(0);
+
+				checkConnected();
+			}
+			return payload;
+		}
+
+		/*
+		* Method: commit
+		* Task: Publish the reserved request. The service is not woken until flush.
+		* Args: type - Application defined message type
+		*		length - Length of the payload actually written
+		* Return: The identifier of the request, echoed by its reply
+		*/
+		unsigned long long commit(unsigned long type, size_t length)
+		{
+			checkConnected();
+
+			unsigned long long id = _nextId++;
+			_requests.commit(type, id, length);
+			return id;
+		}
+
+		/*
+		* Method: post
+		* Task: Copy and publish a request without waking the service
+		* Args: type - Application defined message type
+		*		data, length - The request payload
+		*		timeout - Maximum time to wait for room in the request ring in milliseconds
+		* Return: The identifier of the request, echoed by its reply
+		*/
+		unsigned long long post(unsigned long type, const void* data, size_t length, unsigned long timeout = INFINITE)
+		{
+			void* payload = reserve(length, timeout);
+			if (payload == NULL)
+			{
+				throw WinApiLastErrorException("Command timed out", ERROR_TIMEOUT);
+			}
+			if (length)
+			{
+				memcpy(payload, data, length);
+			}
+			return commit(type, length);
+		}
+
+		/* Wake the service if it's blocked - once per batch of posted requests */
+		void flush()
+		{
+			CommandChannel::notify(_header->serverWaiting, _serverEvent);
+		}
+
+		/*
+		* Method: receive
+		* Task: Wait for the next reply. Replies arrive in the order of the requests.
+		* Args: reply - Receives the reply, its payload is valid until release
+		*		timeout - Maximum time to wait in milliseconds
+		* Return: false if no reply arrived in time
+		*/
+		bool receive(CommandMessage& reply, unsigned long timeout = INFINITE)
+		{
+			if (_holding)
+			{
+				release();
+			}
+			checkConnected();
+
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+			while (!_responses.peek(_received))
+			{
+				unsigned long remaining = timeout;
+				if (timeout != INFINITE)
+				{
+					auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+					if (left <= 0)
+					{
+						return false;
+					}
+					remaining = static_cast<unsigned long>(left);
+				}
+
+				checkConnected();
+
+				_responses.wait(CommandChannel::slots(_header)[_slot].response.waiting, _clientEvent, remaining);
+			}
+
+			_holding = true;
+			reply = _received;
+			return true;
+		}
+
+		/* Consume the reply returned by receive, waking the service if it waits for room in the response ring */
+		void release()
+		{
+			if (_holding)
+			{
+				_holding = false;
+				if (isConnected())
+				{
+					_responses.release(_received);
+					CommandChannel::notify(CommandChannel::slots(_header)[_slot].response.blocked, _serverEvent);
+				}
+			}
+		}
+
+		/*
+		* Method: call
+		* Task: Send a request and wait for its reply - a single round trip
+		* Args: type - Application defined message type
+		*		data, length - The request payload
+		*		response - Receives a copy of the reply payload
+		*		timeout - Maximum time to wait in milliseconds
+		* Return: The type of the reply
+		*/
+		unsigned long call(unsigned long type, const void* data, size_t length, std::vector<char>& response, unsigned long timeout = INFINITE)
+		{
+			unsigned long long id = post(type, data, length, timeout);
+			flush();
+
+			CommandMessage reply;
+			do
+			{
+				if (!receive(reply, timeout))
+				{
+					throw WinApiLastErrorException("Command timed out", ERROR_TIMEOUT);
+				}
+			} while (reply.id != id);	//Skip replies of posted requests
+
+			const char* payload = static_cast<const char*>(reply.payload);
+			response.assign(payload, payload + reply.length);
+			unsigned long reply_type = reply.type;
+			release();
+
+			return reply_type;
+		}
+	};
+}
+
+#endif /* SERVICE_COMMAND_CLIENT_HPP_ */
\ No newline at end of file
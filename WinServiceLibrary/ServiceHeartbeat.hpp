@@ -0,0 +1,364 @@
+#ifndef SERVICE_HEARTBEAT_HPP_
+#define SERVICE_HEARTBEAT_HPP_
+
+#include "WinApiLastErrorException.hpp"
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Layout of the shared-memory heartbeat slot of a service.
+	* Each field is written with a single interlocked operation so readers never need a lock.
+	*/
+	struct HeartbeatSlot
+	{
+		volatile LONG64		counter;	//Monotonic heartbeat counter
+		volatile LONG64		lastBeat;	//GetTickCount64() of the last heartbeat (system wide, comparable between processes)
+		volatile LONG		ready;		//Readiness flag - 0 not ready, 1 ready
+		volatile LONG		health;		//Application defined health word
+	};
+
+	/*
+	* Snapshot of a heartbeat slot as seen by a reader
+	*/
+	struct HeartbeatProbe
+	{
+		bool				available;	//Whether the service exposes a heartbeat slot (false - other fields are 0)
+		unsigned long long	counter;	//The heartbeat counter
+		unsigned long long	age;		//Milliseconds since the last heartbeat
+		bool				ready;		//The readiness flag
+		unsigned long		health;		//The application defined health word
+		bool				stale;		//Whether the heartbeat is older than the requested limit
+	};
+
+	/*
+	* Writer side of the heartbeat - owned by the service.
+	* Updates are lock-free and safe to call from any worker thread. Before open is called (or if it failed)
+	* all updates are ignored.
+	*/
+	class ServiceHeartbeat
+	{
+	private:
+		HANDLE				_mapping;	//The file mapping holding the slot
+		HeartbeatSlot*		_slot;		//The mapped slot
+
+	public:
+		/*
+		* Method: mappingName
+		* Task: Return the name of the file mapping holding the heartbeat slot of a service
+		* Args: service_name - The name of the service
+		* Return: The name of the file mapping
+		*/
+		static std::string mappingName(const char* service_name)
+		{
+			//Services run in session 0, "Global\" makes the slot visible to controllers in other sessions
+			return std::string("Global\\WinServiceLib.Heartbeat.") + service_name;
+		}
+
+		/*
+		* Method: Constructor
+		* Task: Construct a closed heartbeat
+		* Args: None
+		* Returns: Instance of ServiceHeartbeat
+		*/
+		ServiceHeartbeat()
+			: _mapping(NULL), _slot(NULL)
+		{}
+
+		/*
+		* Method: Destructor
+		* Task: Release the heartbeat slot
+		* Args: None
+		* Returns: None
+		*/
+		~ServiceHeartbeat()
+		{
+			close();
+		}
+
+		ServiceHeartbeat(const ServiceHeartbeat&) = delete;
+		ServiceHeartbeat& operator=(const ServiceHeartbeat&) = delete;
+
+		/*
+		* Method: open
+		* Task: Create the shared-memory heartbeat slot of a service and reset it
+		* Args: service_name - The name of the service
+		* Return: None
+		*/
+		void open(const char* service_name)
+		{
+			close();
+
+			HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(HeartbeatSlot), mappingName(service_name).c_str());
+			if (mapping == NULL)
+			{
+				throw WinApiLastErrorException("Heartbeat CreateFileMapping failed", GetLastError());
+			}
+
+			HeartbeatSlot* slot = static_cast<HeartbeatSlot*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(HeartbeatSlot)));
+			if (slot == NULL)
+			{
+				unsigned long error = GetLastError();
+				CloseHandle(mapping);
+				throw WinApiLastErrorException("Heartbeat MapViewOfFile failed", error);
+			}
+
+			//The slot may survive a restart of the service while a reader still maps it
+			InterlockedExchange(&slot->ready, 0);
+			InterlockedExchange(&slot->health, 0);
+			InterlockedExchange64(&slot->lastBeat, static_cast<LONG64>(GetTickCount64()));
+
+			_mapping = mapping;
+			_slot = slot;
+		}
+
+		/*
+		* Method: close
+		* Task: Mark the service not ready and release the heartbeat slot
+		* Args: None
+		* Return: None
+		*/
+		void close()
+		{
+			if (_slot)
+			{
+				InterlockedExchange(&_slot->ready, 0);
+				UnmapViewOfFile(_slot);
+				_slot = NULL;
+			}
+
+			if (_mapping)
+			{
+				CloseHandle(_mapping);
+				_mapping = NULL;
+			}
+		}
+
+		/* Return whether the heartbeat slot is open */
+		bool isOpen() const
+		{
+			return _slot != NULL;
+		}
+
+		/* Signal the service is alive - call periodically from the worker threads */
+		void beat()
+		{
+			if (_slot)
+			{
+				InterlockedIncrement64(&_slot->counter);
+				InterlockedExchange64(&_slot->lastBeat, static_cast<LONG64>(GetTickCount64()));
+			}
+		}
+
+		/* Set whether the service is ready to serve */
+		void setReady(bool ready)
+		{
+			if (_slot)
+			{
+				InterlockedExchange(&_slot->ready, ready ? 1 : 0);
+			}
+		}
+
+		/* Set the application defined health word */
+		void setHealth(unsigned long health)
+		{
+			if (_slot)
+			{
+				InterlockedExchange(&_slot->health, static_cast<LONG>(health));
+			}
+		}
+	};
+
+	/*
+	* Reader side of the heartbeat - used by controllers.
+	* Keeps the slot mapped so repeated probes of the same service cost a few memory reads.
+	*/
+	class HeartbeatReader
+	{
+	private:
+		HANDLE					_mapping;	//The file mapping holding the slot
+		const HeartbeatSlot*	_slot;		//The mapped slot
+		std::string				_name;		//The name of the service
+
+		/*
+		* Method: attach
+		* Task: Map the heartbeat slot of the service if it's available
+		* Args: None
+		* Return: true if the slot is mapped
+		*/
+		bool attach()
+		{
+			if (_slot)
+			{
+				return true;
+			}
+
+			HANDLE mapping = OpenFileMapping(FILE_MAP_READ, FALSE, ServiceHeartbeat::mappingName(_name.c_str()).c_str());
+			if (mapping == NULL)
+			{
+				//The service is not running or doesn't expose a heartbeat
+				return false;
+			}
+
+			const HeartbeatSlot* slot = static_cast<const HeartbeatSlot*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(HeartbeatSlot)));
+			if (slot == NULL)
+			{
+				CloseHandle(mapping);
+				return false;
+			}
+
+			_mapping = mapping;
+			_slot = slot;
+			return true;
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct a reader of the heartbeat slot of a service. The slot is mapped lazily.
+		* Args: service_name - The name of the service
+		* Returns: Instance of HeartbeatReader
+		*/
+		explicit HeartbeatReader(const char* service_name)
+			: _mapping(NULL), _slot(NULL), _name(service_name)
+		{}
+
+		/*
+		* Method: Destructor
+		* Task: Release the mapped slot
+		* Args: None
+		* Returns: None
+		*/
+		~HeartbeatReader()
+		{
+			detach();
+		}
+
+		HeartbeatReader(const HeartbeatReader&) = delete;
+		HeartbeatReader& operator=(const HeartbeatReader&) = delete;
+
+		HeartbeatReader(HeartbeatReader&& other)
+			: _mapping(other._mapping), _slot(other._slot), _name(std::move(other._name))
+		{
+			other._mapping = NULL;
+			other._slot = NULL;
+		}
+
+		/* Release the mapped slot - the next probe maps it again (e.g. after the service restarted) */
+		void detach()
+		{
+			if (_slot)
+			{
+				UnmapViewOfFile(_slot);
+				_slot = NULL;
+			}
+
+			if (_mapping)
+			{
+				CloseHandle(_mapping);
+				_mapping = NULL;
+			}
+		}
+
+		/*
+		* Method: probe
+		* Task: Read the heartbeat slot of the service
+		* Args: stale_after - Milliseconds without a heartbeat after which the service is considered stale
+		* Return: Snapshot of the slot
+		*/
+		HeartbeatProbe probe(unsigned long long stale_after)
+		{
+			HeartbeatProbe result = { false, 0, 0, false, 0, false };
+
+			if (!attach())
+			{
+				return result;
+			}
+
+			//Atomic 64-bit loads - plain loads can tear on x86. The view is read-only, so an interlocked
+			//compare-exchange (which writes) can't be used.
+			unsigned long long now = GetTickCount64();
+			unsigned long long last_beat = static_cast<unsigned long long>(ReadAcquire64(&_slot->lastBeat));
+
+			result.available = true;
+			result.counter = static_cast<unsigned long long>(ReadAcquire64(&_slot->counter));
+			result.age = (now > last_beat) ? (now - last_beat) : 0;
+			result.ready = ReadAcquire(&_slot->ready) != 0;
+			result.health = static_cast<unsigned long>(ReadAcquire(&_slot->health));
+			result.stale = result.age > stale_after;
+
+			return result;
+		}
+	};
+
+	/*
+	* Batch reader of the heartbeats of many services - used by controllers probing periodically.
+	* Keeps a HeartbeatReader per service, so each probe round only reads the mapped slots;
+	* a slot is mapped once, when its service first exposes it.
+	*/
+	class HeartbeatMonitor
+	{
+	private:
+		std::vector<HeartbeatReader>	_readers;	//One reader per service, in the order of the names
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct a monitor of the heartbeat slots of services. The slots are mapped lazily.
+		* Args: service_names - The names of the services to monitor
+		* Returns: Instance of HeartbeatMonitor
+		*/
+		explicit HeartbeatMonitor(const std::vector<std::string>& service_names)
+		{
+			_readers.reserve(service_names.size());
+			for (const std::string& service_name : service_names)
+			{
+				_readers.emplace_back(service_name.c_str());
+			}
+		}
+
+		HeartbeatMonitor(const HeartbeatMonitor&) = delete;
+		HeartbeatMonitor& operator=(const HeartbeatMonitor&) = delete;
+
+		/* Return the number of monitored services */
+		size_t size() const
+		{
+			return _readers.size();
+		}
+
+		/*
+		* Method: probe
+		* Task: Read the heartbeat slots of all monitored services
+		* Args: stale_after - Milliseconds without a heartbeat after which a service is considered stale
+		*		probes - Receives the snapshots, in the order of the names (reused between rounds)
+		* Return: None
+		*/
+		void probe(unsigned long long stale_after, std::vector<HeartbeatProbe>& probes)
+		{
+			probes.resize(_readers.size());
+			for (size_t index = 0; index < _readers.size(); ++index)
+			{
+				probes[index] = _readers[index].probe(stale_after);
+			}
+		}
+
+		/* Read the heartbeat slots of all monitored services, in the order of the names */
+		std::vector<HeartbeatProbe> probe(unsigned long long stale_after)
+		{
+			std::vector<HeartbeatProbe> probes;
+			probe(stale_after, probes);
+			return probes;
+		}
+
+		/* Release the mapped slot of a service - the next probe maps it again (e.g. after the service restarted) */
+		void detach(size_t index)
+		{
+			_readers.at(index).detach();
+		}
+	};
+}
+
+#endif /* SERVICE_HEARTBEAT_HPP_ */
\ No newline at end of file
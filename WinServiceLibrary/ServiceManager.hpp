@@ -1,11 +1,21 @@
 #ifndef SERVICE_MANAGER_HPP_
 #define SERVICE_MANAGER_HPP_
 
+#include "ServiceCommandClient.hpp"
+#include "ServiceHeartbeat.hpp"
+#include "ServicePlacement.hpp"
+#include "ServiceShard.hpp"
+#include "ServiceTimeline.hpp"
+
 #include <Windows.h>
 #include <exception>
+#include <iostream>
+#include <vector>
 
 namespace WinServiceLib
 {
+	class ServiceResourceSampler;
+
 	/*
 	* This module manages the Service class
 	* It allows interaction with the SCM including installation of the Service
@@ -13,6 +23,8 @@ namespace WinServiceLib
 	class ServiceManager
 	{
 	private:
+		friend class ServiceResourceSampler;
+
 		enum class Action
 		{
 			START,
@@ -81,7 +93,7 @@ namespace WinServiceLib
 			// Open the local default service control manager database
 			if ((services_manager = OpenSCManager(NULL, NULL, manager_access)) == NULL)
 			{
-				throw std::exception("OpenSCManager failed", GetLastError());
+				throw WinApiLastErrorException("OpenSCManager failed", GetLastError());
 			}
 
 			return services_manager;
@@ -101,7 +113,36 @@ namespace WinServiceLib
 			//Important, to execute this, we must request CHANGE_CONFIG access when creating the server
 			if (ChangeServiceConfig2(service_handle, SERVICE_CONFIG_DESCRIPTION, &description) == 0)
 			{
-				throw std::exception("ChangeServiceConfig2 failed", GetLastError());
+				throw WinApiLastErrorException("ChangeServiceConfig2 failed", GetLastError());
+			}
+		}
+
+		/*
+		* Method: serviceSetRecovery
+		* Task: Sets the recovery actions of a service - restart it after a failure, including a stop with an error
+		* Args: service_handle - A handle to the service, with SERVICE_CHANGE_CONFIG and SERVICE_START access
+		*		restart_delay - Delay before the SCM restarts the service, in milliseconds
+		*		reset_period - Time without failures after which the failure count is reset, in seconds
+		* Returns: None
+		*/
+		static void serviceSetRecovery(SC_HANDLE service_handle, unsigned long restart_delay, unsigned long reset_period)
+		{
+			SC_ACTION actions[3] = { { SC_ACTION_RESTART, restart_delay }, { SC_ACTION_RESTART, restart_delay }, { SC_ACTION_RESTART, restart_delay } };
+			SERVICE_FAILURE_ACTIONS failure_actions = {};
+			failure_actions.dwResetPeriod = reset_period;
+			failure_actions.cActions = sizeof(actions) / sizeof(actions[0]);
+			failure_actions.lpsaActions = actions;
+
+			if (ChangeServiceConfig2(service_handle, SERVICE_CONFIG_FAILURE_ACTIONS, &failure_actions) == 0)
+			{
+				throw WinApiLastErrorException("ChangeServiceConfig2 failed", GetLastError());
+			}
+
+			//Without the flag the SCM runs the actions only when the process exits without reporting SERVICE_STOPPED
+			SERVICE_FAILURE_ACTIONS_FLAG flag = { TRUE };
+			if (ChangeServiceConfig2(service_handle, SERVICE_CONFIG_FAILURE_ACTIONS_FLAG, &flag) == 0)
+			{
+				throw WinApiLastErrorException("ChangeServiceConfig2 failed", GetLastError());
 			}
 		}
 
@@ -141,7 +182,7 @@ namespace WinServiceLib
 				service_password				// Password of the account
 			)) == NULL)
 			{
-				throw std::exception("CreateService failed", GetLastError());
+				throw WinApiLastErrorException("CreateService failed", GetLastError());
 			}
 
 			return service_handle;
@@ -161,7 +202,7 @@ namespace WinServiceLib
 
 			if ((service_handle = OpenService(services_manager, service_name, service_access)) == NULL)
 			{
-				throw std::exception("OpenService failed", GetLastError());
+				throw WinApiLastErrorException("OpenService failed", GetLastError());
 			}
 
 			return service_handle;
@@ -179,7 +220,7 @@ namespace WinServiceLib
 		{
 			if (StartService(service_handle, 0, NULL) == 0)
 			{
-				throw std::exception("StartService failed", GetLastError());
+				throw WinApiLastErrorException("StartService failed", GetLastError());
 			}
 		}
 
@@ -197,7 +238,7 @@ namespace WinServiceLib
 
 			if (ControlService(service_handle, SERVICE_CONTROL_STOP, &service_status) == 0 && GetLastError() != ERROR_SERVICE_NOT_ACTIVE)
 			{
-				throw std::exception("ControlService failed", GetLastError());
+				throw WinApiLastErrorException("ControlService failed", GetLastError());
 			}
 
 			//Query service status and wait until it's state is not longer stop pending
@@ -208,7 +249,7 @@ namespace WinServiceLib
 
 			if (service_status.dwCurrentState != SERVICE_STOPPED)
 			{
-				throw std::exception("Service state is not SERVICE_STOPPED");
+				throw WinApiLastErrorException("Service state is not SERVICE_STOPPED", ERROR_SERVICE_REQUEST_TIMEOUT);
 			}
 		}
 
@@ -224,8 +265,70 @@ namespace WinServiceLib
 		{
 			if (DeleteService(service_handle) == FALSE)
 			{
-				throw std::exception("DeleteService failed", GetLastError());
+				throw WinApiLastErrorException("DeleteService failed", GetLastError());
+			}
+		}
+
+		/*
+		* Method: serviceQueryStatus
+		* Task: Queries the current status of an already installed service using it's handle
+		* Args: service_handle - A service to the handle.
+		* Returns: The current state of the service (SERVICE_RUNNING, SERVICE_STOPPED...)
+		*
+		* Notice: The handle must have SERVICE_QUERY_STATUS access.
+		*/
+		static unsigned long serviceQueryStatus(SC_HANDLE service_handle)
+		{
+			SERVICE_STATUS service_status = {};
+
+			if (QueryServiceStatus(service_handle, &service_status) == 0)
+			{
+				throw WinApiLastErrorException("QueryServiceStatus failed", GetLastError());
 			}
+
+			return service_status.dwCurrentState;
+		}
+
+		/*
+		* Method: serviceQueryProcessId
+		* Task: Queries the process identifier of an already installed service using it's handle
+		* Args: service_handle - A service to the handle.
+		* Returns: The process identifier of the service, 0 if the service is not running
+		*
+		* Notice: The handle must have SERVICE_QUERY_STATUS access.
+		*/
+		static unsigned long serviceQueryProcessId(SC_HANDLE service_handle)
+		{
+			SERVICE_STATUS_PROCESS service_status = {};
+			DWORD bytes_needed = 0;
+
+			if (QueryServiceStatusEx(service_handle, SC_STATUS_PROCESS_INFO, reinterpret_cast<LPBYTE>(&service_status), sizeof(service_status), &bytes_needed) == 0)
+			{
+				throw WinApiLastErrorException("QueryServiceStatusEx failed", GetLastError());
+			}
+
+			return service_status.dwProcessId;
+		}
+
+		/*
+		* Method: serviceControl
+		* Task: Sends a control code to an already installed service using it's handle
+		* Args: service_handle - A service to the handle.
+		*		control_code - The control code to send
+		* Returns: The state of the service after it handled the control code
+		*
+		* Notice: The handle must have SERVICE_USER_DEFINED_CONTROL access for codes 128-255.
+		*/
+		static unsigned long serviceControl(SC_HANDLE service_handle, unsigned long control_code)
+		{
+			SERVICE_STATUS service_status = {};
+
+			if (ControlService(service_handle, control_code, &service_status) == 0)
+			{
+				throw WinApiLastErrorException("ControlService failed", GetLastError());
+			}
+
+			return service_status.dwCurrentState;
 		}
 
 		/*
@@ -272,7 +375,7 @@ namespace WinServiceLib
 			//Get service executable path
 			if (GetModuleFileName(NULL, buffer, buffer_length) == 0)
 			{
-				throw std::exception("GetModuleFileName failed", GetLastError());
+				throw WinApiLastErrorException("GetModuleFileName failed", GetLastError());
 			}
 		}
 
@@ -307,10 +410,89 @@ namespace WinServiceLib
 
 				serviceSetDescription(service_handle, service_description);
 			}
-			catch (const std::exception& ex)
+			catch (const std::exception&)
+			{
+				serviceCleanupHandles(service_handle, services_manager);
+				throw;
+			}
+
+			serviceCleanupHandles(service_handle, services_manager);
+		}
+
+		/*
+		* Method: installService
+		* Task: Installs the Service with the SCM together with a placement policy (core sets, NUMA node,
+		*		priority class and per thread role affinity). BaseService applies the policy when the service starts.
+		* Args:	service_path ... service_start_type - See installService above
+		*		placement - The placement policy of the service
+		* Returns: None
+		*/
+		static void installService(const char* service_path, const char* service_name, const char* service_display_name, const char* service_dependencies,
+			const char* service_account, const char* service_password, const char* service_description, unsigned long service_start_type,
+			const PlacementPolicy& placement)
+		{
+			installService(service_path, service_name, service_display_name, service_dependencies,
+				service_account, service_password, service_description, service_start_type);
+
+			try
+			{
+				setServicePlacement(service_name, placement);
+			}
+			catch (const std::exception&)
+			{
+				// Don't leave a service installed without its placement.
+				try
+				{
+					uninstallService(service_name);
+				}
+				catch (const std::exception&)
+				{
+				}
+				throw;
+			}
+		}
+
+		/*
+		* Method: setServicePlacement
+		* Task: Stores the placement policy of an installed service. It takes effect on the next start of the service.
+		*		Instances of a service group are configured with setInstancePlacement.
+		* Args: service_name - The name of the service
+		*		placement - The placement policy of the service
+		* Returns: None
+		*/
+		static void setServicePlacement(const char* service_name, const PlacementPolicy& placement)
+		{
+			ServicePlacement::save(service_name, placement);
+		}
+
+		/*
+		* Method: setServiceRecovery
+		* Task: Makes the SCM restart an installed service when it fails - when its process crashes and when it
+		*		reports SERVICE_STOPPED with an error, as BaseService does after a crash loop of its components.
+		*		For a service group, call it with the name of every instance (ServiceShard::instanceName).
+		* Args: service_name - The name of the service
+		*		restart_delay - Delay before the SCM restarts the service, in milliseconds
+		*		reset_period - Time without failures after which the failure count is reset, in seconds
+		* Returns: None
+		*/
+		static void setServiceRecovery(const char* service_name, unsigned long restart_delay = 1000, unsigned long reset_period = 86400)
+		{
+			unsigned long manager_access = SC_MANAGER_CONNECT;
+			unsigned long service_access = SERVICE_CHANGE_CONFIG | SERVICE_START;
+
+			SC_HANDLE services_manager = NULL;
+			SC_HANDLE service_handle = NULL;
+
+			try
+			{
+				services_manager = serviceOpenManager(manager_access);
+				service_handle = serviceOpen(services_manager, service_name, service_access);
+				serviceSetRecovery(service_handle, restart_delay, reset_period);
+			}
+			catch (const std::exception&)
 			{
 				serviceCleanupHandles(service_handle, services_manager);
-				throw std::exception(ex.what(), GetLastError());
+				throw;
 			}
 
 			serviceCleanupHandles(service_handle, services_manager);
@@ -363,6 +545,458 @@ namespace WinServiceLib
 
 			controlService(service_name, Action::STOP, service_access, manager_access);
 		}
+
+		/*
+		* Method: queryService
+		* Task: Query the current state of an installed service using the SCM.
+		*
+		* Args: service_name - The name of the service to query
+		* Returns: The current state of the service (SERVICE_RUNNING, SERVICE_STOPPED...)
+		*/
+		static unsigned long queryService(const char* service_name)
+		{
+			unsigned long manager_access = SC_MANAGER_CONNECT;
+			unsigned long service_access = SERVICE_QUERY_STATUS;
+
+			SC_HANDLE services_manager = NULL;
+			SC_HANDLE service_handle = NULL;
+			unsigned long state = 0;
+
+			try
+			{
+				services_manager = serviceOpenManager(manager_access);
+				service_handle = serviceOpen(services_manager, service_name, service_access);
+				state = serviceQueryStatus(service_handle);
+			}
+			catch (const std::exception&)
+			{
+				serviceCleanupHandles(service_handle, services_manager);
+				throw;
+			}
+
+			serviceCleanupHandles(service_handle, services_manager);
+			return state;
+		}
+
+		/*
+		* Method: queryServiceProcessId
+		* Task: Query the process identifier of an installed service using the SCM.
+		*
+		* Args: service_name - The name of the service to query
+		* Returns: The process identifier of the service, 0 if the service is not running
+		*/
+		static unsigned long queryServiceProcessId(const char* service_name)
+		{
+			unsigned long manager_access = SC_MANAGER_CONNECT;
+			unsigned long service_access = SERVICE_QUERY_STATUS;
+
+			SC_HANDLE services_manager = NULL;
+			SC_HANDLE service_handle = NULL;
+			unsigned long process_id = 0;
+
+			try
+			{
+				services_manager = serviceOpenManager(manager_access);
+				service_handle = serviceOpen(services_manager, service_name, service_access);
+				process_id = serviceQueryProcessId(service_handle);
+			}
+			catch (const std::exception&)
+			{
+				serviceCleanupHandles(service_handle, services_manager);
+				throw;
+			}
+
+			serviceCleanupHandles(service_handle, services_manager);
+			return process_id;
+		}
+
+		/*
+		* Method: installServiceGroup
+		* Task: Installs instance_count instances of one service definition with the SCM. Instance i is named
+		*		"<service_name>_i", and its binary path carries the shard switches read by ServiceShard::current().
+		*		Every instance stores the shared configuration overlaid with its own configuration (its values win),
+		*		and its own placement policy, e.g. to run every instance on its own NUMA node.
+		*		If an instance can't be installed, the instances installed so far are uninstalled.
+		* Args:	service_path ... service_start_type - See installService, names are the names of the group
+		*		instance_count - Number of instances
+		*		configuration - Configuration shared by all instances
+		*		instance_configurations - Configuration overlay per instance, by index (may be shorter than instance_count)
+		*		instance_placements - Placement policy per instance, by index (may be shorter than instance_count)
+		* Returns: None
+		*/
+		static void installServiceGroup(const char* service_path, const char* service_name, const char* service_display_name, const char* service_dependencies,
+			const char* service_account, const char* service_password, const char* service_description, unsigned long service_start_type,
+			unsigned long instance_count, const ShardConfiguration& configuration = ShardConfiguration(),
+			const std::vector<ShardConfiguration>& instance_configurations = std::vector<ShardConfiguration>(),
+			const std::vector<PlacementPolicy>& instance_placements = std::vector<PlacementPolicy>())
+		{
+			unsigned long installed = 0;
+
+			try
+			{
+				for (unsigned long index = 0; index < instance_count; ++index)
+				{
+					std::string name = ServiceShard::instanceName(service_name, index);
+					std::string display_name = ServiceShard::instanceDisplayName(service_display_name, index);
+					std::string path = ServiceShard::instancePath(service_path, index, instance_count);
+
+					installService(path.c_str(), name.c_str(), display_name.c_str(), service_dependencies,
+						service_account, service_password, service_description, service_start_type);
+					++installed;
+
+					ShardConfiguration instance_configuration = configuration;
+					if (index < instance_configurations.size())
+					{
+						for (const auto& value : instance_configurations[index])
+						{
+							instance_configuration[value.first] = value.second;
+						}
+					}
+
+					if (!instance_configuration.empty())
+					{
+						ServiceShard::saveConfiguration(name.c_str(), instance_configuration);
+					}
+
+					if (index < instance_placements.size())
+					{
+						setServicePlacement(name.c_str(), instance_placements[index]);
+					}
+				}
+			}
+			catch (const std::exception&)
+			{
+				//Roll back the instances created by this call
+				for (unsigned long index = 0; index < installed; ++index)
+				{
+					try
+					{
+						uninstallService(ServiceShard::instanceName(service_name, index).c_str());
+					}
+					catch (const std::exception&)
+					{
+					}
+				}
+				throw;
+			}
+		}
+
+		/*
+		* Method: uninstallServiceGroup
+		* Task: Uninstalls all the instances of a service group. Every instance is attempted.
+		* Args: service_name - The name of the group
+		*		instance_count - Number of instances
+		* Returns: Status of every instance, error is set for instances that couldn't be uninstalled
+		*/
+		static std::vector<ServiceInstanceStatus> uninstallServiceGroup(const char* service_name, unsigned long instance_count)
+		{
+			std::vector<ServiceInstanceStatus> instances;
+
+			for (unsigned long index = 0; index < instance_count; ++index)
+			{
+				ServiceInstanceStatus instance = { ServiceShard::instanceName(service_name, index), SERVICE_STOPPED, NO_ERROR };
+
+				try
+				{
+					uninstallService(instance.name.c_str());
+				}
+				catch (const WinApiLastErrorException& ex)
+				{
+					instance.state = 0;
+					instance.error = ex.lastErrorCode;
+				}
+
+				instances.push_back(instance);
+			}
+
+			return instances;
+		}
+
+		/*
+		* Method: setInstanceConfiguration
+		* Task: Stores configuration values of one instance of a group, replacing values of the same name.
+		*		The instance reads them with ServiceShard::loadConfiguration when it starts.
+		* Args: service_name - The name of the group
+		*		index - The index of the instance
+		*		configuration - The values to store
+		* Returns: None
+		*/
+		static void setInstanceConfiguration(const char* service_name, unsigned long index, const ShardConfiguration& configuration)
+		{
+			ServiceShard::saveConfiguration(ServiceShard::instanceName(service_name, index).c_str(), configuration);
+		}
+
+		/*
+		* Method: setInstancePlacement
+		* Task: Stores the placement policy of one instance of a group. It takes effect on the next start of the instance.
+		* Args: service_name - The name of the group
+		*		index - The index of the instance
+		*		placement - The placement policy of the instance
+		* Returns: None
+		*/
+		static void setInstancePlacement(const char* service_name, unsigned long index, const PlacementPolicy& placement)
+		{
+			setServicePlacement(ServiceShard::instanceName(service_name, index).c_str(), placement);
+		}
+
+		/*
+		* Method: startServiceGroup
+		* Task: Starts all the instances of a service group. The SCM starts the instances concurrently,
+		*		the call doesn't wait for them to reach SERVICE_RUNNING (see queryServiceGroup).
+		* Args: service_name - The name of the group
+		*		instance_count - Number of instances
+		* Returns: Status of every instance, error is set for instances that couldn't be started
+		*/
+		static std::vector<ServiceInstanceStatus> startServiceGroup(const char* service_name, unsigned long instance_count)
+		{
+			std::vector<ServiceInstanceStatus> instances;
+			SC_HANDLE services_manager = serviceOpenManager(SC_MANAGER_CONNECT);
+
+			for (unsigned long index = 0; index < instance_count; ++index)
+			{
+				ServiceInstanceStatus instance = { ServiceShard::instanceName(service_name, index), SERVICE_START_PENDING, NO_ERROR };
+				SC_HANDLE service_handle = NULL;
+
+				try
+				{
+					service_handle = serviceOpen(services_manager, instance.name.c_str(), SERVICE_START);
+					serviceStart(service_handle);
+				}
+				catch (const WinApiLastErrorException& ex)
+				{
+					//An instance already running is started
+					instance.error = (ex.lastErrorCode == ERROR_SERVICE_ALREADY_RUNNING) ? NO_ERROR : ex.lastErrorCode;
+					instance.state = (instance.error == NO_ERROR) ? SERVICE_RUNNING : 0;
+				}
+
+				serviceCleanupHandle(service_handle);
+				instances.push_back(instance);
+			}
+
+			serviceCleanupHandle(services_manager);
+			return instances;
+		}
+
+		/*
+		* Method: stopServiceGroup
+		* Task: Stops all the instances of a service group. The stop command is sent to every instance first,
+		*		then the call waits until no instance is stop pending - the instances stop concurrently.
+		* Args: service_name - The name of the group
+		*		instance_count - Number of instances
+		* Returns: Status of every instance, error is set for instances that couldn't be stopped
+		*/
+		static std::vector<ServiceInstanceStatus> stopServiceGroup(const char* service_name, unsigned long instance_count)
+		{
+			std::vector<ServiceInstanceStatus> instances;
+			std::vector<SC_HANDLE> handles(instance_count, NULL);
+			SC_HANDLE services_manager = serviceOpenManager(SC_MANAGER_CONNECT);
+
+			for (unsigned long index = 0; index < instance_count; ++index)
+			{
+				ServiceInstanceStatus instance = { ServiceShard::instanceName(service_name, index), SERVICE_STOP_PENDING, NO_ERROR };
+				SERVICE_STATUS service_status = {};
+
+				try
+				{
+					handles[index] = serviceOpen(services_manager, instance.name.c_str(), SERVICE_STOP | SERVICE_QUERY_STATUS);
+					if (ControlService(handles[index], SERVICE_CONTROL_STOP, &service_status) == 0 && GetLastError() != ERROR_SERVICE_NOT_ACTIVE)
+					{
+						throw WinApiLastErrorException("ControlService failed", GetLastError());
+					}
+				}
+				catch (const WinApiLastErrorException& ex)
+				{
+					instance.error = ex.lastErrorCode;
+					instance.state = 0;
+				}
+
+				instances.push_back(instance);
+			}
+
+			//Wait for all the instances together
+			for (bool pending = true; pending; )
+			{
+				pending = false;
+				for (unsigned long index = 0; index < instance_count; ++index)
+				{
+					if (instances[index].error != NO_ERROR || instances[index].state != SERVICE_STOP_PENDING)
+					{
+						continue;
+					}
+
+					try
+					{
+						instances[index].state = serviceQueryStatus(handles[index]);
+					}
+					catch (const WinApiLastErrorException& ex)
+					{
+						instances[index].error = ex.lastErrorCode;
+						instances[index].state = 0;
+					}
+					pending |= (instances[index].state == SERVICE_STOP_PENDING);
+				}
+
+				if (pending)
+				{
+					Sleep(STATE_CHANGE_WAIT);
+				}
+			}
+
+			for (unsigned long index = 0; index < instance_count; ++index)
+			{
+				if (instances[index].error == NO_ERROR && instances[index].state != SERVICE_STOPPED)
+				{
+					instances[index].error = ERROR_SERVICE_REQUEST_TIMEOUT;
+				}
+				serviceCleanupHandle(handles[index]);
+			}
+
+			serviceCleanupHandle(services_manager);
+			return instances;
+		}
+
+		/*
+		* Method: queryServiceGroup
+		* Task: Query the state of all the instances of a service group using the SCM.
+		* Args: service_name - The name of the group
+		*		instance_count - Number of instances
+		* Returns: The state of every instance and the number of instances per state
+		*/
+		static ServiceGroupStatus queryServiceGroup(const char* service_name, unsigned long instance_count)
+		{
+			ServiceGroupStatus group;
+			SC_HANDLE services_manager = serviceOpenManager(SC_MANAGER_CONNECT);
+
+			for (unsigned long index = 0; index < instance_count; ++index)
+			{
+				ServiceInstanceStatus instance = { ServiceShard::instanceName(service_name, index), 0, NO_ERROR };
+				SC_HANDLE service_handle = NULL;
+
+				try
+				{
+					service_handle = serviceOpen(services_manager, instance.name.c_str(), SERVICE_QUERY_STATUS);
+					instance.state = serviceQueryStatus(service_handle);
+				}
+				catch (const WinApiLastErrorException& ex)
+				{
+					instance.error = ex.lastErrorCode;
+				}
+
+				serviceCleanupHandle(service_handle);
+
+				switch (instance.state)
+				{
+				case 0:					++group.failed;		break;
+				case SERVICE_RUNNING:	++group.running;	break;
+				case SERVICE_STOPPED:	++group.stopped;	break;
+				default:				++group.pending;	break;
+				}
+
+				group.instances.push_back(instance);
+			}
+
+			serviceCleanupHandle(services_manager);
+			return group;
+		}
+
+		/*
+		* Method: sendControl
+		* Task: Sends a custom control code (128-255) to a running service using the SCM.
+		*		The SCM delivers the code to the handler of the service.
+		*
+		* Args: service_name - The name of the service to control
+		*		control_code - The control code to send
+		* Returns: The state of the service after it handled the control code
+		*/
+		static unsigned long sendControl(const char* service_name, unsigned long control_code)
+		{
+			unsigned long manager_access = SC_MANAGER_CONNECT;
+			unsigned long service_access = SERVICE_USER_DEFINED_CONTROL | SERVICE_QUERY_STATUS;
+
+			SC_HANDLE services_manager = NULL;
+			SC_HANDLE service_handle = NULL;
+			unsigned long state = 0;
+
+			try
+			{
+				services_manager = serviceOpenManager(manager_access);
+				service_handle = serviceOpen(services_manager, service_name, service_access);
+				state = serviceControl(service_handle, control_code);
+			}
+			catch (const std::exception&)
+			{
+				serviceCleanupHandles(service_handle, services_manager);
+				throw;
+			}
+
+			serviceCleanupHandles(service_handle, services_manager);
+			return state;
+		}
+
+		/*
+		* Method: requestTimelineExport
+		* Task: Ask a running service to export its startup/shutdown timeline (see BaseService::enableTimeline).
+		*		The service writes the Chrome trace-event JSON file to the path it was configured with.
+		*
+		* Args: service_name - The name of the service
+		* Returns: The state of the service after it handled the request
+		*/
+		static unsigned long requestTimelineExport(const char* service_name)
+		{
+			return sendControl(service_name, SERVICE_CONTROL_EXPORT_TIMELINE);
+		}
+
+		/*
+		* Method: sendCommand
+		* Task: Send a single request over the shared-memory command channel of a running service and wait for the reply.
+		*
+		* Args: service_name - The name of the service
+		*		type - Application defined message type
+		*		data, length - The request payload
+		*		response - Receives the reply payload
+		*		timeout - Maximum time to wait for the reply in milliseconds
+		* Returns: The type of the reply
+		*
+		* Notice: Connecting costs a few system calls - keep a ServiceCommandClient for repeated or batched requests.
+		*/
+		static unsigned long sendCommand(const char* service_name, unsigned long type, const void* data, size_t length,
+			std::vector<char>& response, unsigned long timeout = INFINITE)
+		{
+			ServiceCommandClient client(service_name);
+			return client.call(type, data, length, response, timeout);
+		}
+
+		/*
+		* Method: probeHeartbeat
+		* Task: Read the shared-memory heartbeat slot of a running service directly, without going through the SCM.
+		*		Detects services that are RUNNING for the SCM but whose worker threads stopped beating.
+		*
+		* Args: service_name - The name of the service to probe
+		*		stale_after - Milliseconds without a heartbeat after which the service is flagged stale
+		* Returns: Snapshot of the heartbeat slot (available is false if the service exposes none)
+		*
+		* Notice: For periodic probing keep a HeartbeatReader per service, it maps the slot only once.
+		*/
+		static HeartbeatProbe probeHeartbeat(const char* service_name, unsigned long long stale_after)
+		{
+			return HeartbeatReader(service_name).probe(stale_after);
+		}
+
+		/*
+		* Method: probeHeartbeats
+		* Task: Read the shared-memory heartbeat slots of many services once
+		*
+		* Args: service_names - The names of the services to probe
+		*		stale_after - Milliseconds without a heartbeat after which a service is flagged stale
+		* Returns: Snapshots of the heartbeat slots, in the order of the names
+		*
+		* Notice: Every call maps and unmaps all slots. For periodic probing keep a HeartbeatMonitor,
+		*		it maps each slot only once and its probes only read the slots.
+		*/
+		static std::vector<HeartbeatProbe> probeHeartbeats(const std::vector<std::string>& service_names, unsigned long long stale_after)
+		{
+			return HeartbeatMonitor(service_names).probe(stale_after);
+		}
 	};
 }
 
@@ -0,0 +1,289 @@
+#ifndef SERVICE_PLACEMENT_HPP_
+#define SERVICE_PLACEMENT_HPP_
+
+#include "WinApiLastErrorException.hpp"
+
+#include <Windows.h>
+
+#include <string>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Placement of the threads of one role (e.g. "io", "worker") of a service
+	*/
+	struct ThreadPlacement
+	{
+		std::string			role;		//The role the threads were created with
+		unsigned long long	affinity;	//Processor mask of the threads within the process mask, 0 - inherit the process affinity
+		int					priority;	//Thread priority (THREAD_PRIORITY_*)
+	};
+
+	/*
+	* Placement policy of a service - stored with the service configuration at install time and applied when the service starts.
+	* Masks address the processors of the first processor group (up to 64 logical processors).
+	*/
+	struct PlacementPolicy
+	{
+		unsigned long long				affinity;		//Processor mask of the process, 0 - all processors
+		long							numaNode;		//NUMA node the process is restricted to, -1 - any node
+		unsigned long					priorityClass;	//Priority class of the process (HIGH_PRIORITY_CLASS...), 0 - unchanged
+		std::vector<ThreadPlacement>	threads;		//Placement of the threads per role
+
+		PlacementPolicy()
+			: affinity(0), numaNode(-1), priorityClass(0)
+		{}
+	};
+
+	/*
+	* Stores placement policies in the registry key of the service and applies them to the process and its threads
+	*/
+	class ServicePlacement
+	{
+	private:
+		/*
+		* Method: keyPath
+		* Task: Return the registry path holding the placement policy of a service
+		* Args: service_name - The name of the service
+		* Return: Path relative to HKEY_LOCAL_MACHINE
+		*/
+		static std::string keyPath(const char* service_name)
+		{
+			return std::string("SYSTEM\\CurrentControlSet\\Services\\") + service_name + "\\Parameters\\Placement";
+		}
+
+		/* Throw if a registry call failed */
+		static void check(LSTATUS status, const char* message)
+		{
+			if (status != ERROR_SUCCESS)
+			{
+				throw WinApiLastErrorException(message, static_cast<unsigned int>(status));
+			}
+		}
+
+		/* Write a QWORD value */
+		static void writeQword(HKEY key, const char* name, unsigned long long value)
+		{
+			check(RegSetValueEx(key, name, 0, REG_QWORD, reinterpret_cast<const BYTE*>(&value), sizeof(value)), "RegSetValueEx failed");
+		}
+
+		/* Write a DWORD value */
+		static void writeDword(HKEY key, const char* name, unsigned long value)
+		{
+			DWORD data = value;
+			check(RegSetValueEx(key, name, 0, REG_DWORD, reinterpret_cast<const BYTE*>(&data), sizeof(data)), "RegSetValueEx failed");
+		}
+
+		/* Read a QWORD value, returns the fallback if it's missing */
+		static unsigned long long readQword(HKEY key, const char* subkey, const char* name, unsigned long long fallback)
+		{
+			unsigned long long value = 0;
+			DWORD size = sizeof(value);
+			return RegGetValue(key, subkey, name, RRF_RT_REG_QWORD, NULL, &value, &size) == ERROR_SUCCESS ? value : fallback;
+		}
+
+		/* Read a DWORD value, returns the fallback if it's missing */
+		static unsigned long readDword(HKEY key, const char* subkey, const char* name, unsigned long fallback)
+		{
+			DWORD value = 0;
+			DWORD size = sizeof(value);
+			return RegGetValue(key, subkey, name, RRF_RT_REG_DWORD, NULL, &value, &size) == ERROR_SUCCESS ? value : fallback;
+		}
+
+	public:
+		/* Static class - deleted constructor & destructor */
+		ServicePlacement() = delete;
+		~ServicePlacement() = delete;
+
+		/*
+		* Method: save
+		* Task: Store the placement policy with the configuration of an installed service
+		* Args: service_name - The name of the service
+		*		policy - The policy to store
+		* Return: None
+		*/
+		static void save(const char* service_name, const PlacementPolicy& policy)
+		{
+			HKEY key = NULL;
+			std::string path = keyPath(service_name);
+
+			//A role running on none of the processors of the process could never be applied
+			for (const ThreadPlacement& thread : policy.threads)
+			{
+				if (thread.affinity && policy.affinity && (thread.affinity & policy.affinity) == 0)
+				{
+					throw WinApiLastErrorException("Placement of role " + thread.role + " has no processor of the process affinity", ERROR_INVALID_PARAMETER);
+				}
+			}
+
+			check(RegCreateKeyEx(HKEY_LOCAL_MACHINE, path.c_str(), 0, NULL, REG_OPTION_NON_VOLATILE, KEY_READ | KEY_WRITE | DELETE, NULL, &key, NULL), "RegCreateKeyEx failed");
+
+			try
+			{
+				//Drop the roles of the previous policy
+				LSTATUS status = RegDeleteTree(key, "Threads");
+				if (status != ERROR_FILE_NOT_FOUND)
+				{
+					check(status, "RegDeleteTree failed");
+				}
+
+				writeQword(key, "Affinity", policy.affinity);
+				writeDword(key, "NumaNode", static_cast<unsigned long>(policy.numaNode));
+				writeDword(key, "PriorityClass", policy.priorityClass);
+
+				for (const ThreadPlacement& thread : policy.threads)
+				{
+					HKEY role = NULL;
+					std::string role_path = "Threads\\" + thread.role;
+
+					check(RegCreateKeyEx(key, role_path.c_str(), 0, NULL, REG_OPTION_NON_VOLATILE, KEY_WRITE, NULL, &role, NULL), "RegCreateKeyEx failed");
+					try
+					{
+						writeQword(role, "Affinity", thread.affinity);
+						writeDword(role, "Priority", static_cast<unsigned long>(thread.priority));
+					}
+					catch (const std::exception&)
+					{
+						RegCloseKey(role);
+						throw;
+					}
+					RegCloseKey(role);
+				}
+			}
+			catch (const std::exception&)
+			{
+				RegCloseKey(key);
+				throw;
+			}
+
+			RegCloseKey(key);
+		}
+
+		/*
+		* Method: load
+		* Task: Read the placement policy stored with the configuration of a service
+		* Args: service_name - The name of the service
+		*		policy - Receives the policy
+		* Return: false if the service has no placement policy
+		*/
+		static bool load(const char* service_name, PlacementPolicy& policy)
+		{
+			HKEY key = NULL;
+			std::string path = keyPath(service_name);
+
+			if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, path.c_str(), 0, KEY_READ, &key) != ERROR_SUCCESS)
+			{
+				return false;
+			}
+
+			policy = PlacementPolicy();
+			policy.affinity = readQword(key, NULL, "Affinity", 0);
+			policy.numaNode = static_cast<long>(readDword(key, NULL, "NumaNode", static_cast<unsigned long>(-1)));
+			policy.priorityClass = readDword(key, NULL, "PriorityClass", 0);
+
+			HKEY threads = NULL;
+			if (RegOpenKeyEx(key, "Threads", 0, KEY_READ, &threads) == ERROR_SUCCESS)
+			{
+				char role[256];
+				DWORD length = sizeof(role);
+
+				for (DWORD index = 0; RegEnumKeyEx(threads, index, role, &length, NULL, NULL, NULL, NULL) == ERROR_SUCCESS; ++index, length = sizeof(role))
+				{
+					ThreadPlacement thread;
+					thread.role = role;
+					thread.affinity = readQword(threads, role, "Affinity", 0);
+					thread.priority = static_cast<int>(readDword(threads, role, "Priority", THREAD_PRIORITY_NORMAL));
+					policy.threads.push_back(thread);
+				}
+
+				RegCloseKey(threads);
+			}
+
+			RegCloseKey(key);
+			return true;
+		}
+
+		/*
+		* Method: applyProcess
+		* Task: Apply the process wide part of a policy - NUMA node, affinity and priority class - to the current process
+		* Args: policy - The policy to apply
+		* Return: None
+		*/
+		static void applyProcess(const PlacementPolicy& policy)
+		{
+			unsigned long long affinity = policy.affinity;
+
+			if (policy.numaNode >= 0)
+			{
+				ULONGLONG node_mask = 0;
+				if (GetNumaNodeProcessorMask(static_cast<UCHAR>(policy.numaNode), &node_mask) == 0)
+				{
+					throw WinApiLastErrorException("GetNumaNodeProcessorMask failed", GetLastError());
+				}
+
+				//Restrict the requested cores to the node, or use the whole node
+				affinity = affinity ? (affinity & node_mask) : node_mask;
+				if (affinity == 0)
+				{
+					throw WinApiLastErrorException("Placement affinity has no processor on the NUMA node", ERROR_INVALID_PARAMETER);
+				}
+			}
+
+			if (affinity && SetProcessAffinityMask(GetCurrentProcess(), static_cast<DWORD_PTR>(affinity)) == 0)
+			{
+				throw WinApiLastErrorException("SetProcessAffinityMask failed", GetLastError());
+			}
+
+			if (policy.priorityClass && SetPriorityClass(GetCurrentProcess(), policy.priorityClass) == 0)
+			{
+				throw WinApiLastErrorException("SetPriorityClass failed", GetLastError());
+			}
+		}
+
+		/*
+		* Method: applyThread
+		* Task: Apply the placement of a role to the calling thread. Roles without a placement keep the process placement.
+		*		The affinity of the role is restricted to the processors of the process (as set by the process affinity
+		*		and the NUMA node); a role with none of them keeps the process affinity.
+		* Args: policy - The policy of the service
+		*		role - The role of the calling thread
+		* Return: None
+		*/
+		static void applyThread(const PlacementPolicy& policy, const std::string& role)
+		{
+			for (const ThreadPlacement& thread : policy.threads)
+			{
+				if (thread.role != role)
+				{
+					continue;
+				}
+
+				if (thread.affinity)
+				{
+					DWORD_PTR process_mask = 0;
+					DWORD_PTR system_mask = 0;
+					if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) == 0)
+					{
+						throw WinApiLastErrorException("GetProcessAffinityMask failed", GetLastError());
+					}
+
+					DWORD_PTR affinity = static_cast<DWORD_PTR>(thread.affinity) & process_mask;
+					if (affinity && SetThreadAffinityMask(GetCurrentThread(), affinity) == 0)
+					{
+						throw WinApiLastErrorException("SetThreadAffinityMask failed", GetLastError());
+					}
+				}
+
+				if (SetThreadPriority(GetCurrentThread(), thread.priority) == 0)
+				{
+					throw WinApiLastErrorException("SetThreadPriority failed", GetLastError());
+				}
+
+				return;
+			}
+		}
+	};
+}
+
+#endif /* SERVICE_PLACEMENT_HPP_ */
\ No newline at end of file
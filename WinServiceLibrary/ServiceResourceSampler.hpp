@@ -0,0 +1,458 @@
+#ifndef SERVICE_RESOURCE_SAMPLER_HPP_
+#define SERVICE_RESOURCE_SAMPLER_HPP_
+
+#include "ServiceManager.hpp"
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <TlHelp32.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#pragma comment(lib, "Psapi.lib")
+
+namespace WinServiceLib
+{
+	/*
+	* Resource usage of a service process at one point in time
+	*/
+	struct ResourceSample
+	{
+		unsigned long long	timestamp;		//GetTickCount64() when the sample was taken
+		unsigned long		processId;		//The process of the service, 0 if it was not running
+		double				cpuPercent;		//CPU usage since the previous sample, 100% is all cores busy
+		unsigned long long	workingSet;		//Working set in bytes
+		unsigned long long	privateBytes;	//Private (commit) bytes
+		unsigned long		threads;		//Number of threads
+		unsigned long		handles;		//Number of open handles
+	};
+
+	/*
+	* Measured cost of sampling a set of services periodically
+	*/
+	struct SamplerOverhead
+	{
+		size_t			services;			//Number of sampled services
+		unsigned long	rounds;				//Number of sampling rounds measured
+		double			averageRound;		//Average duration of a round in milliseconds
+		double			maxRound;			//Longest round in milliseconds
+		double			cpuPerRound;		//CPU time (user + kernel) of the sampling thread per round in milliseconds
+		double			cpuPercentOfCore;	//CPU used by the sampling thread at the measured interval, 100% is one core busy
+	};
+
+	/*
+	* Fixed capacity time series - keeps the newest samples, overwriting the oldest
+	*/
+	class ResourceTimeSeries
+	{
+	private:
+		std::vector<ResourceSample>	_samples;	//Ring buffer storage
+		size_t						_next;		//Index the next sample is written to
+		size_t						_count;		//Number of valid samples
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct an empty time series
+		* Args: capacity - Maximum number of samples kept
+		* Returns: Instance of ResourceTimeSeries
+		*/
+		explicit ResourceTimeSeries(size_t capacity)
+			: _samples(capacity ? capacity : 1), _next(0), _count(0)
+		{}
+
+		/* Append a sample, dropping the oldest one when full */
+		void push(const ResourceSample& sample)
+		{
+			_samples[_next] = sample;
+			_next = (_next + 1) % _samples.size();
+			if (_count < _samples.size())
+			{
+				++_count;
+			}
+		}
+
+		/* Return the number of samples kept */
+		size_t size() const
+		{
+			return _count;
+		}
+
+		/* Return the maximum number of samples kept */
+		size_t capacity() const
+		{
+			return _samples.size();
+		}
+
+		/* Return a sample, 0 is the oldest and size() - 1 the newest */
+		const ResourceSample& at(size_t index) const
+		{
+			return _samples[(_next + _samples.size() - _count + index) % _samples.size()];
+		}
+
+		/* Return the newest sample, the series must not be empty */
+		const ResourceSample& latest() const
+		{
+			return at(_count - 1);
+		}
+	};
+
+	/*
+	* Samples CPU, memory, thread and handle usage of a set of services.
+	* The SCM connection, service handles and process handles are kept open between rounds, and a single
+	* process snapshot per round provides the thread counts of all services, so a round costs a few
+	* system calls per service.
+	*/
+	class ServiceResourceSampler
+	{
+	private:
+		struct Target
+		{
+			std::string				name;		//The name of the service
+			SC_HANDLE				service;	//The service, opened with SERVICE_QUERY_STATUS, NULL if it couldn't be opened
+			unsigned long			error;		//Why the service couldn't be opened, 0 if it's sampled
+			unsigned long			processId;	//The process the handle below belongs to
+			HANDLE					process;	//The process of the service
+			unsigned long long		cpuTime;	//Kernel + user time at the previous sample (100ns units)
+			long long				wallTime;	//QueryPerformanceCounter at the previous sample
+			ResourceTimeSeries		series;		//The samples of the service
+		};
+
+		SC_HANDLE				_manager;		//The SCM
+		std::vector<Target>		_targets;		//The sampled services
+		long long				_frequency;		//QueryPerformanceFrequency
+		unsigned long			_processors;	//Number of logical processors
+		double					_lastRound;		//Duration of the last sampling round in milliseconds
+
+		/* Return a QueryPerformanceCounter value */
+		static long long now()
+		{
+			LARGE_INTEGER counter;
+			QueryPerformanceCounter(&counter);
+			return counter.QuadPart;
+		}
+
+		/* Convert FILETIME to 100ns units */
+		static unsigned long long toUnits(const FILETIME& time)
+		{
+			return (static_cast<unsigned long long>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+		}
+
+		/*
+		* Method: threadCounts
+		* Task: Take a snapshot of all processes and map their identifiers to their thread counts
+		* Args: counts - Receives the thread counts
+		* Return: None
+		*/
+		static void threadCounts(std::unordered_map<unsigned long, unsigned long>& counts)
+		{
+			HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+			if (snapshot == INVALID_HANDLE_VALUE)
+			{
+				return;
+			}
+
+			PROCESSENTRY32 entry = {};
+			entry.dwSize = sizeof(entry);
+			for (BOOL more = Process32First(snapshot, &entry); more; more = Process32Next(snapshot, &entry))
+			{
+				counts[entry.th32ProcessID] = entry.cntThreads;
+			}
+
+			CloseHandle(snapshot);
+		}
+
+		/*
+		* Method: attach
+		* Task: Make sure the target holds a handle to the current process of the service
+		* Args: target - The sampled service
+		*		process_id - The current process of the service
+		* Return: None
+		*/
+		static void attach(Target& target, unsigned long process_id)
+		{
+			if (target.processId == process_id && target.process)
+			{
+				return;
+			}
+
+			//The service restarted or stopped - the CPU baseline belongs to the old process
+			if (target.process)
+			{
+				CloseHandle(target.process);
+				target.process = NULL;
+			}
+
+			target.processId = process_id;
+			target.cpuTime = 0;
+			target.wallTime = 0;
+
+			if (process_id != 0)
+			{
+				target.process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, process_id);
+			}
+		}
+
+		/*
+		* Method: sampleTarget
+		* Task: Take a sample of one service
+		* Args: target - The sampled service
+		*		threads - Thread counts of all processes
+		*		timestamp - The timestamp of the round
+		* Return: None
+		*/
+		void sampleTarget(Target& target, const std::unordered_map<unsigned long, unsigned long>& threads, unsigned long long timestamp)
+		{
+			ResourceSample sample = { timestamp, 0, 0.0, 0, 0, 0, 0 };
+			unsigned long process_id = 0;
+
+			try
+			{
+				process_id = ServiceManager::serviceQueryProcessId(target.service);
+			}
+			catch (const std::exception&)
+			{
+				process_id = 0;
+			}
+
+			attach(target, process_id);
+
+			if (target.process)
+			{
+				FILETIME creation, exit, kernel, user;
+				long long wall = now();
+
+				if (GetProcessTimes(target.process, &creation, &exit, &kernel, &user))
+				{
+					unsigned long long cpu = toUnits(kernel) + toUnits(user);
+					if (target.wallTime != 0 && wall > target.wallTime)
+					{
+						//CPU time is in 100ns units, wall time in performance counter ticks
+						double cpu_seconds = static_cast<double>(cpu - target.cpuTime) / 10000000.0;
+						double wall_seconds = static_cast<double>(wall - target.wallTime) / static_cast<double>(_frequency);
+						sample.cpuPercent = 100.0 * cpu_seconds / (wall_seconds * _processors);
+					}
+					target.cpuTime = cpu;
+					target.wallTime = wall;
+				}
+
+				PROCESS_MEMORY_COUNTERS_EX memory = {};
+				memory.cb = sizeof(memory);
+				if (GetProcessMemoryInfo(target.process, reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memory), sizeof(memory)))
+				{
+					sample.workingSet = memory.WorkingSetSize;
+					sample.privateBytes = memory.PrivateUsage;
+				}
+
+				DWORD handles = 0;
+				if (GetProcessHandleCount(target.process, &handles))
+				{
+					sample.handles = handles;
+				}
+
+				auto count = threads.find(process_id);
+				if (count != threads.end())
+				{
+					sample.threads = count->second;
+				}
+
+				sample.processId = process_id;
+			}
+
+			target.series.push(sample);
+		}
+
+		/* Return the user + kernel time of the calling thread in 100ns units */
+		static unsigned long long threadCpuTime()
+		{
+			FILETIME creation, exit, kernel, user;
+			if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user) == 0)
+			{
+				return 0;
+			}
+
+			return toUnits(kernel) + toUnits(user);
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Open the SCM and the sampled services. A service that can't be opened (e.g. it's not installed)
+		*		is skipped by the rounds and its error is kept, see error.
+		* Args: service_names - The names of the services to sample
+		*		history - Number of samples kept per service
+		* Returns: Instance of ServiceResourceSampler
+		*/
+		ServiceResourceSampler(const std::vector<std::string>& service_names, size_t history = 300)
+			: _manager(NULL), _frequency(1), _processors(1), _lastRound(0.0)
+		{
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			_frequency = frequency.QuadPart;
+
+			DWORD processors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+			_processors = processors ? processors : 1;
+
+			_targets.reserve(service_names.size());
+
+			try
+			{
+				_manager = ServiceManager::serviceOpenManager(SC_MANAGER_CONNECT);
+
+				for (const std::string& name : service_names)
+				{
+					SC_HANDLE service = OpenService(_manager, name.c_str(), SERVICE_QUERY_STATUS);
+					unsigned long error = service ? 0 : GetLastError();
+					_targets.push_back({ name, service, error, 0, NULL, 0, 0, ResourceTimeSeries(history) });
+				}
+			}
+			catch (const std::exception&)
+			{
+				close();
+				throw;
+			}
+		}
+
+		/*
+		* Method: Destructor
+		* Task: Close all handles
+		* Args: None
+		* Returns: None
+		*/
+		~ServiceResourceSampler()
+		{
+			close();
+		}
+
+		ServiceResourceSampler(const ServiceResourceSampler&) = delete;
+		ServiceResourceSampler& operator=(const ServiceResourceSampler&) = delete;
+
+		/* Close all handles */
+		void close()
+		{
+			for (Target& target : _targets)
+			{
+				if (target.process)
+				{
+					CloseHandle(target.process);
+				}
+				ServiceManager::serviceCleanupHandle(target.service);
+			}
+			_targets.clear();
+
+			ServiceManager::serviceCleanupHandle(_manager);
+			_manager = NULL;
+		}
+
+		/*
+		* Method: sample
+		* Task: Take one sample of every service and append it to its time series.
+		*		Call periodically (e.g. every second), CPU usage is computed between consecutive calls.
+		* Args: None
+		* Return: None
+		*/
+		void sample()
+		{
+			long long begin = now();
+			unsigned long long timestamp = GetTickCount64();
+
+			std::unordered_map<unsigned long, unsigned long> threads;
+			threads.reserve(_targets.size() * 2);
+			threadCounts(threads);
+
+			for (Target& target : _targets)
+			{
+				if (target.service)
+				{
+					sampleTarget(target, threads, timestamp);
+				}
+			}
+
+			_lastRound = static_cast<double>(now() - begin) * 1000.0 / static_cast<double>(_frequency);
+		}
+
+		/* Return the number of sampled services */
+		size_t size() const
+		{
+			return _targets.size();
+		}
+
+		/* Return the name of a sampled service, in the order given to the constructor */
+		const std::string& name(size_t index) const
+		{
+			return _targets[index].name;
+		}
+
+		/* Return the time series of a sampled service, in the order given to the constructor */
+		const ResourceTimeSeries& series(size_t index) const
+		{
+			return _targets[index].series;
+		}
+
+		/* Return why a service couldn't be opened (its series stays empty), 0 if it's sampled */
+		unsigned long error(size_t index) const
+		{
+			return _targets[index].error;
+		}
+
+		/*
+		* Method: lastRoundDuration
+		* Task: Return the cost of the last sampling round - the sampler's own overhead
+		* Args: None
+		* Return: Duration of the last call to sample() in milliseconds
+		*/
+		double lastRoundDuration() const
+		{
+			return _lastRound;
+		}
+
+		/*
+		* Method: measureOverhead
+		* Task: Sample the services at a fixed interval and measure the cost of sampling - wall time per round and
+		*		CPU time of the calling thread. E.g. 1,000 services at 1 Hz: measureOverhead(60, 1000) on a sampler
+		*		constructed with 1,000 service names. The samples are appended to the time series as usual.
+		* Args: rounds - Number of rounds to measure
+		*		interval - Milliseconds between the beginnings of consecutive rounds
+		* Return: The measured overhead
+		*/
+		SamplerOverhead measureOverhead(unsigned long rounds, unsigned long interval = 1000)
+		{
+			SamplerOverhead overhead = { _targets.size(), rounds, 0.0, 0.0, 0.0, 0.0 };
+			if (rounds == 0)
+			{
+				return overhead;
+			}
+
+			unsigned long long cpu_begin = threadCpuTime();
+			double total = 0.0;
+
+			for (unsigned long round = 0; round < rounds; ++round)
+			{
+				unsigned long long round_begin = GetTickCount64();
+
+				sample();
+				total += _lastRound;
+				overhead.maxRound = (std::max)(overhead.maxRound, _lastRound);
+
+				unsigned long long elapsed = GetTickCount64() - round_begin;
+				if (round + 1 < rounds && elapsed < interval)
+				{
+					Sleep(static_cast<DWORD>(interval - elapsed));
+				}
+			}
+
+			//FILETIME units are 100ns
+			double cpu = static_cast<double>(threadCpuTime() - cpu_begin) / 10000.0;
+
+			overhead.averageRound = total / rounds;
+			overhead.cpuPerRound = cpu / rounds;
+			overhead.cpuPercentOfCore = interval ? (overhead.cpuPerRound * 100.0 / interval) : 0.0;
+			return overhead;
+		}
+	};
+}
+
+#endif /* SERVICE_RESOURCE_SAMPLER_HPP_ */
\ No newline at end of file
@@ -0,0 +1,254 @@
+#ifndef SERVICE_SHARD_HPP_
+#define SERVICE_SHARD_HPP_
+
+#include "WinApiLastErrorException.hpp"
+
+#include <Windows.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/* Configuration values of a service instance, by name */
+	typedef std::map<std::string, std::string> ShardConfiguration;
+
+	/*
+	* Identity of a service instance within its group
+	*/
+	struct ShardInfo
+	{
+		unsigned long	index;		//Index of the instance, 0...count-1
+		unsigned long	count;		//Number of instances in the group, 0 - the service is not sharded
+
+		ShardInfo()
+			: index(0), count(0)
+		{}
+
+		/* Return whether the process runs an instance of a service group */
+		bool isSharded() const
+		{
+			return count != 0;
+		}
+	};
+
+	/*
+	* State of one instance of a service group, as seen by the SCM
+	*/
+	struct ServiceInstanceStatus
+	{
+		std::string		name;		//The service name of the instance
+		unsigned long	state;		//SERVICE_RUNNING, SERVICE_STOPPED..., 0 if the instance couldn't be queried
+		unsigned long	error;		//Error of the last operation on the instance, NO_ERROR on success
+	};
+
+	/*
+	* Aggregate state of a service group
+	*/
+	struct ServiceGroupStatus
+	{
+		std::vector<ServiceInstanceStatus>	instances;	//State of every instance, by index
+		unsigned long						running;	//Instances in SERVICE_RUNNING
+		unsigned long						stopped;	//Instances in SERVICE_STOPPED
+		unsigned long						pending;	//Instances in a pending state or paused
+		unsigned long						failed;		//Instances that couldn't be queried
+
+		ServiceGroupStatus()
+			: running(0), stopped(0), pending(0), failed(0)
+		{}
+
+		/* Return whether every instance of the group is running */
+		bool allRunning() const
+		{
+			return !instances.empty() && running == instances.size();
+		}
+	};
+
+	/*
+	* Naming, command line and configuration of the instances of a service group.
+	* Instance i of group "Name" is installed as service "Name_i", its binary path carries
+	* "--shard=i --shard-count=n" and its configuration is stored in the registry key of the instance.
+	*/
+	class ServiceShard
+	{
+	private:
+		/* Command line switches carrying the identity of the instance */
+		static constexpr const char* INDEX_SWITCH = "--shard=";
+		static constexpr const char* COUNT_SWITCH = "--shard-count=";
+
+		/*
+		* Method: parseSwitch
+		* Task: Parse the value of a numeric switch from a single command line argument
+		* Args: argument - The argument
+		*		name - The switch, including its '='
+		*		value - Receives the value
+		* Return: Whether the argument is the switch followed by a decimal number and nothing else
+		*/
+		static bool parseSwitch(const char* argument, const char* name, unsigned long& value)
+		{
+			size_t length = strlen(name);
+			if (strncmp(argument, name, length) != 0 || argument[length] < '0' || argument[length] > '9')
+			{
+				return false;
+			}
+
+			char* end = NULL;
+			value = strtoul(argument + length, &end, 10);
+			return *end == '\0';
+		}
+
+		/*
+		* Method: parse
+		* Task: Parse the identity of the instance from the arguments of the process. Only whole arguments count -
+		*		the switches appearing inside the executable path or another argument are ignored.
+		* Args: argc, argv - The arguments of the process
+		* Return: The identity, count is 0 if the arguments have no valid shard switches
+		*/
+		static ShardInfo parse(int argc, char** argv)
+		{
+			ShardInfo shard;
+			bool has_index = false;
+			bool has_count = false;
+
+			//argv[0] is the executable
+			for (int i = 1; argv && i < argc; ++i)
+			{
+				if (argv[i])
+				{
+					has_index |= parseSwitch(argv[i], INDEX_SWITCH, shard.index);
+					has_count |= parseSwitch(argv[i], COUNT_SWITCH, shard.count);
+				}
+			}
+
+			if (!has_index || !has_count || shard.index >= shard.count)
+			{
+				shard = ShardInfo();
+			}
+
+			return shard;
+		}
+
+		/*
+		* Method: keyPath
+		* Task: Return the registry path holding the configuration of a service
+		* Args: service_name - The name of the service
+		* Return: Path relative to HKEY_LOCAL_MACHINE
+		*/
+		static std::string keyPath(const char* service_name)
+		{
+			return std::string("SYSTEM\\CurrentControlSet\\Services\\") + service_name + "\\Parameters\\Configuration";
+		}
+
+	public:
+		/* Static class - deleted constructor & destructor */
+		ServiceShard() = delete;
+		~ServiceShard() = delete;
+
+		/*
+		* Method: current
+		* Task: Return the identity of the instance run by this process. The arguments of the process are parsed once,
+		*		later calls return the cached identity.
+		* Args: None
+		* Return: The identity of the instance, count is 0 if the service is not sharded
+		*/
+		static const ShardInfo& current()
+		{
+			static const ShardInfo shard = parse(__argc, __argv);
+			return shard;
+		}
+
+		/* Return the service name of an instance of a group */
+		static std::string instanceName(const char* group_name, unsigned long index)
+		{
+			return std::string(group_name) + "_" + std::to_string(index);
+		}
+
+		/* Return the display name of an instance of a group */
+		static std::string instanceDisplayName(const char* group_display_name, unsigned long index)
+		{
+			return std::string(group_display_name) + " #" + std::to_string(index);
+		}
+
+		/* Return the binary path of an instance - the executable followed by the shard switches */
+		static std::string instancePath(const char* service_path, unsigned long index, unsigned long count)
+		{
+			return std::string("\"") + service_path + "\" " + INDEX_SWITCH + std::to_string(index) + " " + COUNT_SWITCH + std::to_string(count);
+		}
+
+		/*
+		* Method: saveConfiguration
+		* Task: Store configuration values with an installed service, replacing values of the same name
+		* Args: service_name - The name of the service (or instance)
+		*		configuration - The values to store
+		* Return: None
+		*/
+		static void saveConfiguration(const char* service_name, const ShardConfiguration& configuration)
+		{
+			HKEY key = NULL;
+			std::string path = keyPath(service_name);
+
+			LSTATUS status = RegCreateKeyEx(HKEY_LOCAL_MACHINE, path.c_str(), 0, NULL, REG_OPTION_NON_VOLATILE, KEY_WRITE, NULL, &key, NULL);
+			if (status != ERROR_SUCCESS)
+			{
+				throw WinApiLastErrorException("RegCreateKeyEx failed", static_cast<unsigned int>(status));
+			}
+
+			for (const auto& value : configuration)
+			{
+				status = RegSetValueEx(key, value.first.c_str(), 0, REG_SZ,
+					reinterpret_cast<const BYTE*>(value.second.c_str()), static_cast<DWORD>(value.second.size() + 1));
+				if (status != ERROR_SUCCESS)
+				{
+					RegCloseKey(key);
+					throw WinApiLastErrorException("RegSetValueEx failed", static_cast<unsigned int>(status));
+				}
+			}
+
+			RegCloseKey(key);
+		}
+
+		/*
+		* Method: loadConfiguration
+		* Task: Read the configuration values stored with a service
+		* Args: service_name - The name of the service (or instance)
+		* Return: The stored values, empty if the service has none
+		*/
+		static ShardConfiguration loadConfiguration(const char* service_name)
+		{
+			ShardConfiguration configuration;
+			HKEY key = NULL;
+			std::string path = keyPath(service_name);
+
+			if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, path.c_str(), 0, KEY_READ, &key) != ERROR_SUCCESS)
+			{
+				return configuration;
+			}
+
+			char name[256];
+			char data[4096];
+			DWORD name_length = sizeof(name);
+			DWORD data_length = sizeof(data);
+			DWORD type = 0;
+			LSTATUS status;
+
+			for (DWORD index = 0;
+				(status = RegEnumValue(key, index, name, &name_length, NULL, &type, reinterpret_cast<BYTE*>(data), &data_length)) != ERROR_NO_MORE_ITEMS;
+				++index, name_length = sizeof(name), data_length = sizeof(data))
+			{
+				//Values too long for the buffers or of another type are skipped
+				if (status == ERROR_SUCCESS && type == REG_SZ && data_length > 0)
+				{
+					configuration[name] = std::string(data, strnlen(data, data_length));
+				}
+			}
+
+			RegCloseKey(key);
+			return configuration;
+		}
+	};
+}
+
+#endif /* SERVICE_SHARD_HPP_ */
\ No newline at end of file
@@ -0,0 +1,155 @@
+#ifndef SERVICE_STATE_MACHINE_HPP_
+#define SERVICE_STATE_MACHINE_HPP_
+
+#include <Windows.h>
+
+#include <atomic>
+#include <initializer_list>
+
+namespace WinServiceLib
+{
+	/*
+	* Life cycle state machine of a service - the SCM states (SERVICE_STOPPED...SERVICE_PAUSED) and the
+	* transitions allowed between them. The state is atomic and every transition is a compare-and-swap
+	* checked against the transition table, so concurrent requests can't interleave:
+	* a request enters a pending state only from a state that allows it, and only the request that
+	* entered a pending state leaves it.
+	*/
+	class ServiceStateMachine
+	{
+	private:
+		/* Highest SCM state value (SERVICE_PAUSED) */
+		static const unsigned long STATE_COUNT = 8;
+
+		std::atomic<unsigned long>		_state;			//The current state
+		std::atomic<unsigned long long>	_transitions;	//Number of transitions performed
+
+		/*
+		* Method: table
+		* Task: Return the transition table, indexed by [from][to]
+		* Args: None
+		* Return: The transition table
+		*/
+		static const bool (&table())[STATE_COUNT][STATE_COUNT]
+		{
+			static const bool allowed[STATE_COUNT][STATE_COUNT] =
+			{
+				/* from \ to			 -		STOPPED	START_P	STOP_P	RUNNING	CONT_P	PAUSE_P	PAUSED */
+				/* -				*/	{ false,	false,	false,	false,	false,	false,	false,	false },
+				/* STOPPED			*/	{ false,	false,	true,	false,	false,	false,	false,	false },
+				/* START_PENDING	*/	{ false,	true,	false,	false,	true,	false,	false,	false },
+				/* STOP_PENDING		*/	{ false,	true,	false,	false,	true,	false,	false,	true  },
+				/* RUNNING			*/	{ false,	true,	false,	true,	false,	false,	true,	false },
+				/* CONTINUE_PENDING	*/	{ false,	false,	false,	false,	true,	false,	false,	true  },
+				/* PAUSE_PENDING	*/	{ false,	false,	false,	false,	true,	false,	false,	true  },
+				/* PAUSED			*/	{ false,	true,	false,	true,	false,	true,	false,	false }
+			};
+			return allowed;
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct a state machine in the SERVICE_STOPPED state
+		* Args: None
+		* Returns: Instance of ServiceStateMachine
+		*/
+		ServiceStateMachine()
+			: _state(SERVICE_STOPPED), _transitions(0)
+		{}
+
+		ServiceStateMachine(const ServiceStateMachine&) = delete;
+		ServiceStateMachine& operator=(const ServiceStateMachine&) = delete;
+
+		/* Return the current state */
+		unsigned long state() const
+		{
+			return _state.load();
+		}
+
+		/* Return the number of transitions performed */
+		unsigned long long transitions() const
+		{
+			return _transitions.load();
+		}
+
+		/* Return whether a state is one of the SCM states */
+		static bool isValid(unsigned long state)
+		{
+			return state >= SERVICE_STOPPED && state <= SERVICE_PAUSED;
+		}
+
+		/* Return whether a state is one of the pending states of an operation */
+		static bool isPending(unsigned long state)
+		{
+			return state == SERVICE_START_PENDING || state == SERVICE_STOP_PENDING ||
+				state == SERVICE_CONTINUE_PENDING || state == SERVICE_PAUSE_PENDING;
+		}
+
+		/* Return whether the transition table allows moving from one state to another */
+		static bool isAllowed(unsigned long from, unsigned long to)
+		{
+			return isValid(from) && isValid(to) && table()[from][to];
+		}
+
+		/*
+		* Method: transition
+		* Task: Atomically move from an expected state to another state
+		* Args: from - The state the machine is expected to be in
+		*		to - The state to move to
+		* Return: true if the machine was in from and moved to to, false if the transition was rejected
+		*/
+		bool transition(unsigned long from, unsigned long to)
+		{
+			if (!isAllowed(from, to))
+			{
+				return false;
+			}
+
+			if (!_state.compare_exchange_strong(from, to))
+			{
+				return false;
+			}
+
+			++_transitions;
+			return true;
+		}
+
+		/*
+		* Method: begin
+		* Task: Atomically move from any of the given states to a pending state
+		* Args: from - The states the request is accepted in
+		*		pending - The pending state to move to
+		*		previous - Receives the state the machine was in
+		* Return: true if the request was accepted, false if the machine is in none of the given states
+		*/
+		bool begin(std::initializer_list<unsigned long> from, unsigned long pending, unsigned long& previous)
+		{
+			unsigned long current = _state.load();
+
+			for (;;)
+			{
+				bool accepted = false;
+				for (unsigned long state : from)
+				{
+					accepted |= (state == current);
+				}
+
+				if (!accepted || !isAllowed(current, pending))
+				{
+					return false;
+				}
+
+				//On failure current is reloaded and checked again
+				if (_state.compare_exchange_weak(current, pending))
+				{
+					++_transitions;
+					previous = current;
+					return true;
+				}
+			}
+		}
+	};
+}
+
+#endif /* SERVICE_STATE_MACHINE_HPP_ */
\ No newline at end of file
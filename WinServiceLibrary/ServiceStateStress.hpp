@@ -0,0 +1,231 @@
+#ifndef SERVICE_STATE_STRESS_HPP_
+#define SERVICE_STATE_STRESS_HPP_
+
+#include "BaseService.hpp"
+#include "StressHarness.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Result of a stress run of the life cycle state machine
+	*/
+	struct StressReport : HarnessReport
+	{
+		static const size_t OPERATIONS = 5;		//start, stop, pause, resume, shutdown
+
+		unsigned long long			transitions;			//State transitions performed
+		double						seconds;				//Duration of the run
+		double						transitionsPerSecond;	//Throughput of the life cycle, see ServiceStateStress
+		unsigned long long			accepted[OPERATIONS];	//Accepted requests per operation
+		unsigned long long			rejected[OPERATIONS];	//Rejected requests per operation
+	};
+
+	/*
+	* Multi-threaded stress harness for the life cycle of BaseService.
+	* Threads hammer a service - not registered with the SCM - with random controls while callbacks randomly fail,
+	* and the harness checks the invariants of the state machine:
+	*	- the state is always one of the SCM states
+	*	- every callback runs in the pending state of its operation
+	*	- the callbacks, onStart included, never run concurrently
+	*	- once all requests returned, the service is not left in a pending state
+	* Every accepted start also looks up the placement policy in the registry and opens the heartbeat mapping,
+	* so the throughput is the one of the whole life cycle, bounded by those calls, not of the state machine alone.
+	*/
+	class ServiceStateStress : private StressHarness
+	{
+	private:
+		enum Operation
+		{
+			START,
+			STOP,
+			PAUSE,
+			RESUME,
+			SHUTDOWN
+		};
+
+		/*
+		* Service checking the invariants from inside its callbacks
+		*/
+		class StressService : public BaseService
+		{
+		private:
+			ServiceStateStress&		_harness;		//Collects the violations
+			std::atomic<int>		_inCallback;	//Number of exclusive callbacks running
+			double					_failureRate;	//Probability of a callback to fail
+
+			/* Check the callback runs alone in the expected state, and fail it randomly */
+			void enter(unsigned long expected, const char* callback)
+			{
+				if (getState() != expected)
+				{
+					_harness.violation(std::string(callback) + " called outside its pending state");
+				}
+
+				if (++_inCallback != 1)
+				{
+					_harness.violation(std::string(callback) + " runs concurrently with another callback");
+				}
+
+				//Stay inside the callback for a while, giving a concurrent operation the chance to enter
+				std::this_thread::yield();
+				bool fail = _harness.random() < _failureRate;
+
+				if (getState() != expected)
+				{
+					_harness.violation(std::string(callback) + " state changed while the callback ran");
+				}
+
+				--_inCallback;
+
+				if (fail)
+				{
+					throw std::exception("Injected failure");
+				}
+			}
+
+			virtual void onStart(unsigned long, char**) override	{ enter(SERVICE_START_PENDING, "onStart"); }
+			virtual void onStop() override		{ enter(SERVICE_STOP_PENDING, "onStop"); }
+			virtual void onPause() override		{ enter(SERVICE_PAUSE_PENDING, "onPause"); }
+			virtual void onResume() override	{ enter(SERVICE_CONTINUE_PENDING, "onResume"); }
+			virtual void onShutdown() override	{ enter(SERVICE_STOP_PENDING, "onShutdown"); }
+
+		public:
+			StressService(ServiceStateStress& harness, double failure_rate)
+				: BaseService("WinServiceLibStress", true, true, true), _harness(harness), _inCallback(0), _failureRate(failure_rate)
+			{}
+		};
+
+		StressReport					_report;		//The report being collected
+
+		/* Return a uniform random number in [0, 1) from a per-thread generator */
+		double random()
+		{
+			static thread_local std::mt19937 generator(std::random_device{}());
+			return std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+		}
+
+		ServiceStateStress()
+			: _report()
+		{}
+
+		/*
+		* Method: execute
+		* Task: Run the stress on an initialized harness
+		* Args: threads, duration, failure_rate, seed - see run
+		* Return: The report
+		*/
+		StressReport execute(size_t threads, unsigned long duration, double failure_rate, unsigned int seed)
+		{
+			StressService service(*this, failure_rate);
+			std::atomic<bool> running(true);
+			std::vector<std::thread> workers;
+			std::vector<std::vector<unsigned long long>> counts(threads, std::vector<unsigned long long>(2 * StressReport::OPERATIONS, 0));
+
+			auto begin = std::chrono::steady_clock::now();
+
+			for (size_t t = 0; t < threads; ++t)
+			{
+				workers.emplace_back([&, t]()
+				{
+					std::mt19937 generator(seed + static_cast<unsigned int>(t));
+					std::uniform_int_distribution<int> pick(START, SHUTDOWN);
+
+					while (running)
+					{
+						int operation = pick(generator);
+						bool accepted = false;
+
+						try
+						{
+							switch (operation)
+							{
+							case START:		accepted = service.start(0, NULL);	break;
+							case STOP:		accepted = service.stop();			break;
+							case PAUSE:		accepted = service.pause();			break;
+							case RESUME:	accepted = service.resume();		break;
+							case SHUTDOWN:	accepted = service.shutdown();		break;
+							}
+						}
+						catch (const std::exception&)
+						{
+							//Injected start failure - the start was accepted
+							accepted = true;
+						}
+
+						++counts[t][operation * 2 + (accepted ? 0 : 1)];
+					}
+				});
+			}
+
+			//Sample the state concurrently with the workers
+			std::thread monitor([&]()
+			{
+				while (running)
+				{
+					if (!ServiceStateMachine::isValid(service.getState()))
+					{
+						violation("Invalid state " + std::to_string(service.getState()));
+					}
+				}
+			});
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+			running = false;
+
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+			monitor.join();
+
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+			unsigned long final_state = service.getState();
+			if (final_state != SERVICE_STOPPED && final_state != SERVICE_RUNNING && final_state != SERVICE_PAUSED)
+			{
+				violation("Left in pending state " + std::to_string(final_state));
+			}
+
+			_report.transitions = service._machine.transitions();
+			_report.seconds = elapsed.count();
+			_report.transitionsPerSecond = _report.seconds > 0 ? _report.transitions / _report.seconds : 0.0;
+			for (size_t operation = 0; operation < StressReport::OPERATIONS; ++operation)
+			{
+				for (size_t t = 0; t < threads; ++t)
+				{
+					_report.accepted[operation] += counts[t][operation * 2];
+					_report.rejected[operation] += counts[t][operation * 2 + 1];
+				}
+			}
+			collect(_report);
+
+			return _report;
+		}
+
+	public:
+		/*
+		* Method: run
+		* Task: Hammer the life cycle of a service with random controls from many threads and check the invariants
+		* Args: threads - Number of threads sending controls
+		*		duration - Duration of the run in milliseconds
+		*		failure_rate - Probability of a callback to fail (exercises the revert transitions)
+		*		seed - Seed of the control sequences, thread i uses seed + i
+		* Return: Transitions per second, accepted/rejected requests and invariant violations
+		*/
+		static StressReport run(size_t threads = 8, unsigned long duration = 1000, double failure_rate = 0.05, unsigned int seed = 1)
+		{
+			ServiceStateStress harness;
+			return harness.execute(threads, duration, failure_rate, seed);
+		}
+	};
+}
+
+#endif /* SERVICE_STATE_STRESS_HPP_ */
\ No newline at end of file
@@ -0,0 +1,321 @@
+#ifndef SERVICE_TIMELINE_HPP_
+#define SERVICE_TIMELINE_HPP_
+
+#include "WinApiLastErrorException.hpp"
+
+#include <Windows.h>
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/* Custom control code (128-255) asking a service to export its timeline, see ServiceManager::requestTimelineExport */
+	static const unsigned long SERVICE_CONTROL_EXPORT_TIMELINE = 200;
+
+	/*
+	* A recorded span - names and categories must be string literals (or otherwise outlive the export)
+	*/
+	struct TimelineEvent
+	{
+		const char*		name;		//Name of the span
+		const char*		category;	//Category of the span ("lifecycle", "user"...)
+		long long		begin;		//QueryPerformanceCounter at the beginning of the span
+		long long		end;		//QueryPerformanceCounter at the end of the span
+	};
+
+	/*
+	* Process wide timeline of scoped spans, exported as Chrome trace-event JSON (chrome://tracing, Perfetto).
+	* Every thread records into its own fixed size buffer without locks; the exporter reads the published part of the buffers.
+	* When disabled a span costs one relaxed atomic load.
+	*/
+	class ServiceTimeline
+	{
+	private:
+		/*
+		* Events of a single thread - written only by its thread, count is published with release semantics
+		*/
+		struct ThreadBuffer
+		{
+			unsigned long				threadId;	//The recording thread
+			std::vector<TimelineEvent>	events;		//Fixed capacity storage
+			std::atomic<size_t>			count;		//Number of recorded events
+			std::atomic<size_t>			dropped;	//Number of events dropped because the buffer was full
+
+			ThreadBuffer(unsigned long thread_id, size_t capacity)
+				: threadId(thread_id), events(capacity), count(0), dropped(0)
+			{}
+		};
+
+		/*
+		* Shared state of the timeline
+		*/
+		struct State
+		{
+			std::atomic<bool>							enabled;	//Whether spans are recorded
+			std::atomic<unsigned long>					generation;	//Incremented by enable, invalidates older thread buffers
+			size_t										capacity;	//Events per thread buffer
+			long long									origin;		//QueryPerformanceCounter when the timeline was enabled
+			long long									frequency;	//QueryPerformanceFrequency
+			long long									processStart;	//Process creation time converted to QueryPerformanceCounter
+			std::mutex									lock;		//Guards buffers
+			std::vector<std::shared_ptr<ThreadBuffer>>	buffers;	//Buffers of all recording threads
+
+			State()
+				: enabled(false), generation(0), capacity(0), origin(0), frequency(1), processStart(0)
+			{}
+		};
+
+		static State& state()
+		{
+			static State instance;
+			return instance;
+		}
+
+		/* Return the buffer of the calling thread, registering it on first use */
+		static ThreadBuffer* threadBuffer()
+		{
+			static thread_local std::shared_ptr<ThreadBuffer> buffer;
+			static thread_local unsigned long generation = 0;
+
+			State& timeline = state();
+			if (!buffer || generation != timeline.generation.load(std::memory_order_acquire))
+			{
+				std::lock_guard<std::mutex> guard(timeline.lock);
+				buffer = std::make_shared<ThreadBuffer>(GetCurrentThreadId(), timeline.capacity);
+				generation = timeline.generation.load();
+				timeline.buffers.push_back(buffer);
+			}
+
+			return buffer.get();
+		}
+
+		/* Convert QueryPerformanceCounter ticks since the origin to microseconds */
+		static double toMicroseconds(long long ticks)
+		{
+			State& timeline = state();
+			return static_cast<double>(ticks - timeline.origin) * 1000000.0 / static_cast<double>(timeline.frequency);
+		}
+
+		/* Write a JSON string literal */
+		static void writeString(std::ostream& out, const char* text)
+		{
+			out << '"';
+			for (const char* c = text ? text : ""; *c; ++c)
+			{
+				switch (*c)
+				{
+				case '"':	out << "\\\"";	break;
+				case '\\':	out << "\\\\";	break;
+				case '\n':	out << "\\n";	break;
+				case '\r':	out << "\\r";	break;
+				case '\t':	out << "\\t";	break;
+				default:
+					if (static_cast<unsigned char>(*c) < 0x20)
+					{
+						out << ' ';
+					}
+					else
+					{
+						out << *c;
+					}
+					break;
+				}
+			}
+			out << '"';
+		}
+
+		/* Write one complete ("X") trace event */
+		static void writeEvent(std::ostream& out, const TimelineEvent& event, unsigned long thread_id, bool& first)
+		{
+			out << (first ? "\n" : ",\n") << "{\"name\":";
+			writeString(out, event.name);
+			out << ",\"cat\":";
+			writeString(out, event.category);
+			//Fixed nanosecond resolution - the default 6 significant digits round microsecond timestamps after ~1 second
+			out << std::fixed << std::setprecision(3) << ",\"ph\":\"X\",\"ts\":" << toMicroseconds(event.begin)
+				<< ",\"dur\":" << toMicroseconds(event.end) - toMicroseconds(event.begin)
+				<< ",\"pid\":" << GetCurrentProcessId() << ",\"tid\":" << thread_id << "}";
+			first = false;
+		}
+
+	public:
+		/* Static class - deleted constructor & destructor */
+		ServiceTimeline() = delete;
+		~ServiceTimeline() = delete;
+
+		/*
+		* Method: enable
+		* Task: Drop previously recorded spans and start recording
+		* Args: capacity - Maximum number of spans kept per thread, later spans are dropped
+		* Return: None
+		*/
+		static void enable(size_t capacity = 16384)
+		{
+			State& timeline = state();
+			std::lock_guard<std::mutex> guard(timeline.lock);
+
+			LARGE_INTEGER counter, frequency;
+			QueryPerformanceFrequency(&frequency);
+			QueryPerformanceCounter(&counter);
+
+			//Place the creation of the process on the performance counter time line
+			FILETIME creation, exit, kernel, user, now;
+			GetSystemTimeAsFileTime(&now);
+			long long process_start = counter.QuadPart;
+			if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+			{
+				long long since_creation = static_cast<long long>(
+					((static_cast<unsigned long long>(now.dwHighDateTime) << 32) | now.dwLowDateTime) -
+					((static_cast<unsigned long long>(creation.dwHighDateTime) << 32) | creation.dwLowDateTime));
+
+				//FILETIME is in 100ns units
+				process_start -= since_creation * frequency.QuadPart / 10000000;
+			}
+
+			timeline.buffers.clear();
+			timeline.capacity = capacity ? capacity : 1;
+			timeline.frequency = frequency.QuadPart;
+			timeline.origin = process_start;
+			timeline.processStart = process_start;
+			timeline.generation.fetch_add(1, std::memory_order_release);
+			timeline.enabled.store(true, std::memory_order_release);
+		}
+
+		/* Stop recording, the recorded spans are kept */
+		static void disable()
+		{
+			state().enabled.store(false, std::memory_order_release);
+		}
+
+		/* Return whether spans are recorded */
+		static bool isEnabled()
+		{
+			return state().enabled.load(std::memory_order_relaxed);
+		}
+
+		/* Return the current QueryPerformanceCounter value, the time base of the spans */
+		static long long now()
+		{
+			LARGE_INTEGER counter;
+			QueryPerformanceCounter(&counter);
+			return counter.QuadPart;
+		}
+
+		/*
+		* Method: record
+		* Task: Record a span of the calling thread with explicit begin and end - for spans that don't fit a scope
+		* Args: name - Name of the span
+		*		category - Category of the span
+		*		begin, end - QueryPerformanceCounter values (see now)
+		* Return: None
+		*/
+		static void record(const char* name, const char* category, long long begin, long long end)
+		{
+			if (!isEnabled())
+			{
+				return;
+			}
+
+			ThreadBuffer* buffer = threadBuffer();
+			size_t count = buffer->count.load(std::memory_order_relaxed);
+			if (count >= buffer->events.size())
+			{
+				buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			buffer->events[count] = { name, category, begin, end };
+			buffer->count.store(count + 1, std::memory_order_release);
+		}
+
+		/*
+		* Method: exportChrome
+		* Task: Write the recorded spans as Chrome trace-event JSON. Recording may continue meanwhile.
+		* Args: path - The path of the JSON file
+		* Return: None
+		*/
+		static void exportChrome(const std::string& path)
+		{
+			State& timeline = state();
+			std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+			{
+				std::lock_guard<std::mutex> guard(timeline.lock);
+				buffers = timeline.buffers;
+			}
+
+			std::ofstream out(path, std::ios::trunc);
+			bool first = true;
+			size_t dropped = 0;
+
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+			//Time between the creation of the process and the first span of the library
+			long long first_span = timeline.processStart;
+			for (const auto& buffer : buffers)
+			{
+				size_t count = buffer->count.load(std::memory_order_acquire);
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (first_span == timeline.processStart || buffer->events[i].begin < first_span)
+					{
+						first_span = buffer->events[i].begin;
+					}
+				}
+			}
+			writeEvent(out, { "process start", "lifecycle", timeline.processStart, first_span }, GetCurrentThreadId(), first);
+
+			for (const auto& buffer : buffers)
+			{
+				size_t count = buffer->count.load(std::memory_order_acquire);
+				for (size_t i = 0; i < count; ++i)
+				{
+					writeEvent(out, buffer->events[i], buffer->threadId, first);
+				}
+				dropped += buffer->dropped.load(std::memory_order_relaxed);
+			}
+
+			out << "\n],\"otherData\":{\"droppedSpans\":" << dropped << "}}\n";
+
+			if (!out)
+			{
+				throw WinApiLastErrorException("Failed writing timeline " + path, GetLastError());
+			}
+		}
+	};
+
+	/*
+	* Scoped span - records the time between its construction and its destruction on the service timeline.
+	*	TimelineSpan span("load configuration");
+	*/
+	class TimelineSpan
+	{
+	private:
+		const char*		_name;		//Name of the span
+		const char*		_category;	//Category of the span
+		long long		_begin;		//0 if the timeline was disabled when the span began
+
+	public:
+		explicit TimelineSpan(const char* name, const char* category = "user")
+			: _name(name), _category(category), _begin(ServiceTimeline::isEnabled() ? ServiceTimeline::now() : 0)
+		{}
+
+		~TimelineSpan()
+		{
+			if (_begin)
+			{
+				ServiceTimeline::record(_name, _category, _begin, ServiceTimeline::now());
+			}
+		}
+
+		TimelineSpan(const TimelineSpan&) = delete;
+		TimelineSpan& operator=(const TimelineSpan&) = delete;
+	};
+}
+
+#endif /* SERVICE_TIMELINE_HPP_ */
\ No newline at end of file
@@ -0,0 +1,236 @@
+#ifndef SERVICE_TRACE_HPP_
+#define SERVICE_TRACE_HPP_
+
+#include "WinApiLastErrorException.hpp"
+
+#include <Windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Type of a recorded trace event
+	*/
+	enum class TraceEventType : unsigned char
+	{
+		START = 1,		//The SCM started the service, value is argc
+		CONTROL = 2,	//The SCM sent a control code, value is the code
+		STATUS = 3		//The service reported a status, value is the state
+	};
+
+#pragma pack(push, 1)
+	/*
+	* A single recorded event - 13 bytes on disk
+	*/
+	struct TraceEvent
+	{
+		unsigned long long	time;	//Nanoseconds since the recording began
+		unsigned long		value;	//argc, control code or state - see TraceEventType
+		TraceEventType		type;	//The type of the event
+	};
+
+	/*
+	* Header of a binary trace file, followed by count TraceEvents
+	*/
+	struct TraceFileHeader
+	{
+		char				magic[4];	//"WSLT"
+		unsigned long		version;	//TRACE_FILE_VERSION
+		unsigned long long	count;		//Number of events in the file
+	};
+#pragma pack(pop)
+
+	static const unsigned long TRACE_FILE_VERSION = 1;
+
+	/*
+	* Records the control codes and status transitions of a service with high-resolution timestamps.
+	* Recording is off until enable is called, then every event costs a lock and an append.
+	*/
+	class ServiceTraceRecorder
+	{
+	private:
+		std::atomic<bool>		_enabled;	//Whether events are recorded
+		std::mutex				_lock;		//Guards _events
+		std::condition_variable	_recorded;	//Signaled when a status transition is recorded
+		std::vector<TraceEvent>	_events;	//The recorded events
+		size_t					_statusCount;	//Number of recorded status transitions
+		long long				_origin;	//QueryPerformanceCounter when the recording began
+		long long				_frequency;	//QueryPerformanceFrequency
+
+		/* Return nanoseconds since the recording began */
+		unsigned long long elapsed() const
+		{
+			LARGE_INTEGER counter;
+			QueryPerformanceCounter(&counter);
+
+			unsigned long long ticks = static_cast<unsigned long long>(counter.QuadPart - _origin);
+			unsigned long long frequency = static_cast<unsigned long long>(_frequency);
+
+			//Split to avoid overflowing the multiplication
+			return (ticks / frequency) * 1000000000ULL + (ticks % frequency) * 1000000000ULL / frequency;
+		}
+
+	public:
+		/*
+		* Method: Constructor
+		* Task: Construct a disabled recorder
+		* Args: None
+		* Returns: Instance of ServiceTraceRecorder
+		*/
+		ServiceTraceRecorder()
+			: _enabled(false), _statusCount(0), _origin(0), _frequency(1)
+		{
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			_frequency = frequency.QuadPart;
+		}
+
+		ServiceTraceRecorder(const ServiceTraceRecorder&) = delete;
+		ServiceTraceRecorder& operator=(const ServiceTraceRecorder&) = delete;
+
+		/*
+		* Method: enable
+		* Task: Drop previously recorded events and start recording
+		* Args: capacity - Number of events to reserve room for
+		* Return: None
+		*/
+		void enable(size_t capacity = 4096)
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+
+			LARGE_INTEGER counter;
+			QueryPerformanceCounter(&counter);
+
+			_events.clear();
+			_events.reserve(capacity);
+			_statusCount = 0;
+			_origin = counter.QuadPart;
+			_enabled = true;
+		}
+
+		/* Stop recording, the recorded events are kept */
+		void disable()
+		{
+			_enabled = false;
+		}
+
+		/* Return whether events are recorded */
+		bool isEnabled() const
+		{
+			return _enabled;
+		}
+
+		/*
+		* Method: record
+		* Task: Record an event if recording is enabled
+		* Args: type - The type of the event
+		*		value - argc, control code or state
+		* Return: None
+		*/
+		void record(TraceEventType type, unsigned long value)
+		{
+			if (!_enabled)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				_events.push_back({ elapsed(), value, type });
+				if (type != TraceEventType::STATUS)
+				{
+					return;
+				}
+				++_statusCount;
+			}
+			_recorded.notify_all();
+		}
+
+		/*
+		* Method: waitForStatus
+		* Task: Wait until at least count status transitions were recorded
+		* Args: count - The number of transitions to wait for
+		*		timeout - Maximum time to wait in milliseconds
+		* Return: false if the transitions weren't recorded in time
+		*/
+		bool waitForStatus(size_t count, unsigned long timeout)
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			return _recorded.wait_for(guard, std::chrono::milliseconds(timeout), [this, count]() { return _statusCount >= count; });
+		}
+
+		/* Return a copy of the recorded events */
+		std::vector<TraceEvent> events()
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			return _events;
+		}
+
+		/*
+		* Method: save
+		* Task: Write the recorded events to a binary trace file
+		* Args: path - The path of the file
+		* Return: None
+		*/
+		void save(const std::string& path)
+		{
+			std::vector<TraceEvent> recorded = events();
+			TraceFileHeader header = { { 'W', 'S', 'L', 'T' }, TRACE_FILE_VERSION, recorded.size() };
+
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(recorded.data()), static_cast<std::streamsize>(recorded.size() * sizeof(TraceEvent)));
+
+			if (!file)
+			{
+				throw WinApiLastErrorException("Failed writing trace file " + path, GetLastError());
+			}
+		}
+
+		/*
+		* Method: load
+		* Task: Read the events of a binary trace file
+		* Args: path - The path of the file
+		* Return: The recorded events
+		*/
+		static std::vector<TraceEvent> load(const std::string& path)
+		{
+			TraceFileHeader header = {};
+			std::ifstream file(path, std::ios::binary);
+
+			if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+				std::string(header.magic, sizeof(header.magic)) != "WSLT" || header.version != TRACE_FILE_VERSION)
+			{
+				throw WinApiLastErrorException("Invalid trace file " + path, ERROR_INVALID_DATA);
+			}
+
+			//The count is checked against the file size before anything is allocated for it
+			std::streamoff events_begin = file.tellg();
+			file.seekg(0, std::ios::end);
+			std::streamoff events_size = file.tellg() - events_begin;
+			file.seekg(events_begin);
+
+			if (!file || header.count != static_cast<unsigned long long>(events_size) / sizeof(TraceEvent))
+			{
+				throw WinApiLastErrorException("Truncated trace file " + path, ERROR_INVALID_DATA);
+			}
+
+			std::vector<TraceEvent> recorded(static_cast<size_t>(header.count));
+			if (!file.read(reinterpret_cast<char*>(recorded.data()), static_cast<std::streamsize>(recorded.size() * sizeof(TraceEvent))))
+			{
+				throw WinApiLastErrorException("Truncated trace file " + path, ERROR_INVALID_DATA);
+			}
+
+			return recorded;
+		}
+	};
+}
+
+#endif /* SERVICE_TRACE_HPP_ */
\ No newline at end of file
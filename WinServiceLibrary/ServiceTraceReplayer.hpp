@@ -0,0 +1,254 @@
+#ifndef SERVICE_TRACE_REPLAYER_HPP_
+#define SERVICE_TRACE_REPLAYER_HPP_
+
+#include "BaseService.hpp"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* A state of the replayed service that differs from the recording
+	*/
+	struct ReplayDivergence
+	{
+		size_t			index;		//Index of the status transition
+		unsigned long	expected;	//The recorded state (0 if the replay reported more transitions)
+		unsigned long	actual;		//The replayed state (0 if the replay reported fewer transitions)
+	};
+
+	/*
+	* Latency of a control code - from the control to the last status reported before the next control
+	*/
+	struct ReplayLatency
+	{
+		unsigned long		control;	//The control code
+		unsigned long long	expected;	//Recorded latency in nanoseconds
+		unsigned long long	actual;		//Replayed latency in nanoseconds
+	};
+
+	/*
+	* Result of replaying a trace
+	*/
+	struct ReplayReport
+	{
+		std::vector<ReplayDivergence>	divergences;	//Differences in the sequence of states
+		std::vector<ReplayLatency>		latencies;		//Latency of every replayed control
+		std::vector<TraceEvent>			replayed;		//The trace recorded during the replay
+
+		/* Return whether the replay reached the recorded states in the recorded order */
+		bool matches() const
+		{
+			return divergences.empty();
+		}
+	};
+
+	/*
+	* Feeds a recorded trace back into a service under a simulated SCM.
+	* The service is not registered with the SCM, status reports only reach the trace. As with the real SCM,
+	* the service starts on its own thread while control codes arrive on the replaying thread.
+	* The service is isolated: it opens no heartbeat slot or command channel and applies no stored placement,
+	* so a replay under the name of an installed service leaves the running service untouched.
+	*/
+	class ServiceTraceReplayer
+	{
+	public:
+		enum class Speed
+		{
+			ORIGINAL,		//Deliver every control at its recorded time offset
+			FAST			//Deliver controls immediately, keeping their order relative to the recorded status transitions
+		};
+
+	private:
+		/* Time to wait for the service to reach the recorded transitions before giving up */
+		static const unsigned long SETTLE_TIMEOUT = 5000;
+
+		/*
+		* Method: waitForStatus
+		* Task: Wait until the replayed service reported at least count status transitions
+		* Args: service - The replayed service
+		*		count - The number of transitions to wait for
+		* Return: None
+		*/
+		static void waitForStatus(BaseService& service, size_t count)
+		{
+			service._trace.waitForStatus(count, SETTLE_TIMEOUT);
+		}
+
+		/*
+		* Method: statusSequence
+		* Task: Return the states of the status transitions of a trace
+		* Args: trace - The trace
+		* Return: The states, in order
+		*/
+		static std::vector<unsigned long> statusSequence(const std::vector<TraceEvent>& trace)
+		{
+			std::vector<unsigned long> states;
+			for (const TraceEvent& event : trace)
+			{
+				if (event.type == TraceEventType::STATUS)
+				{
+					states.push_back(event.value);
+				}
+			}
+			return states;
+		}
+
+		/*
+		* Method: controlLatencies
+		* Task: Measure the latency of every control of a trace
+		* Args: trace - The trace
+		* Return: Pairs of control code and latency in nanoseconds, in order
+		*/
+		static std::vector<std::pair<unsigned long, unsigned long long>> controlLatencies(const std::vector<TraceEvent>& trace)
+		{
+			std::vector<std::pair<unsigned long, unsigned long long>> latencies;
+
+			for (size_t i = 0; i < trace.size(); ++i)
+			{
+				if (trace[i].type != TraceEventType::CONTROL)
+				{
+					continue;
+				}
+
+				unsigned long long latency = 0;
+				for (size_t j = i + 1; j < trace.size() && trace[j].type != TraceEventType::CONTROL; ++j)
+				{
+					if (trace[j].type == TraceEventType::STATUS)
+					{
+						latency = trace[j].time - trace[i].time;
+					}
+				}
+				latencies.push_back({ trace[i].value, latency });
+			}
+
+			return latencies;
+		}
+
+		/*
+		* Method: compare
+		* Task: Compare the recorded trace to the replayed trace
+		* Args: recorded - The recorded trace
+		*		report - Receives the divergences and latencies
+		* Return: None
+		*/
+		static void compare(const std::vector<TraceEvent>& recorded, ReplayReport& report)
+		{
+			std::vector<unsigned long> expected = statusSequence(recorded);
+			std::vector<unsigned long> actual = statusSequence(report.replayed);
+
+			for (size_t i = 0; i < expected.size() || i < actual.size(); ++i)
+			{
+				unsigned long expected_state = i < expected.size() ? expected[i] : 0;
+				unsigned long actual_state = i < actual.size() ? actual[i] : 0;
+
+				if (expected_state != actual_state)
+				{
+					report.divergences.push_back({ i, expected_state, actual_state });
+				}
+			}
+
+			auto expected_latencies = controlLatencies(recorded);
+			auto actual_latencies = controlLatencies(report.replayed);
+
+			for (size_t i = 0; i < expected_latencies.size(); ++i)
+			{
+				unsigned long long actual_latency = i < actual_latencies.size() ? actual_latencies[i].second : 0;
+				report.latencies.push_back({ expected_latencies[i].first, expected_latencies[i].second, actual_latency });
+			}
+		}
+
+	public:
+		/* Static class - deleted constructor & destructor */
+		ServiceTraceReplayer() = delete;
+		~ServiceTraceReplayer() = delete;
+
+		/*
+		* Method: replay
+		* Task: Replay a recorded trace into a service and report where the replay diverged from the recording
+		* Args: service - The service to replay into, it must not be registered with the SCM
+		*		recorded - The recorded trace (ServiceTraceRecorder::load or BaseService::getTrace)
+		*		speed - Whether to keep the recorded timing or replay as fast as possible
+		* Return: The divergences, the latencies and the replayed trace
+		*/
+		static ReplayReport replay(BaseService& service, const std::vector<TraceEvent>& recorded, Speed speed = Speed::ORIGINAL)
+		{
+			ReplayReport report;
+			std::thread starter;
+			size_t status_seen = 0;
+			auto origin = std::chrono::steady_clock::now();
+
+			service._isolated = true;
+			service.enableTrace(recorded.size() * 2);
+
+			for (const TraceEvent& event : recorded)
+			{
+				if (event.type == TraceEventType::STATUS)
+				{
+					++status_seen;
+					continue;
+				}
+
+				if (speed == Speed::ORIGINAL)
+				{
+					std::this_thread::sleep_until(origin + std::chrono::nanoseconds(event.time));
+				}
+				else
+				{
+					//Deliver the event only once the service reached the point it was delivered at in the recording
+					waitForStatus(service, status_seen);
+				}
+
+				if (event.type == TraceEventType::START && !starter.joinable())
+				{
+					//Only argc is recorded - argv[0] is the service name like the SCM passes it, the other arguments are empty
+					std::vector<std::string> arguments(event.value);
+					if (!arguments.empty())
+					{
+						arguments[0] = service.getName();
+					}
+
+					starter = std::thread([&service, arguments]()
+					{
+						std::vector<char*> argv;
+						for (const std::string& argument : arguments)
+						{
+							argv.push_back(const_cast<char*>(argument.c_str()));
+						}
+						argv.push_back(NULL);
+
+						try
+						{
+							service.start(static_cast<unsigned long>(arguments.size()), argv.data());
+						}
+						catch (const std::exception&)
+						{
+							//The failure is visible in the replayed status sequence
+						}
+					});
+				}
+				else if (event.type == TraceEventType::CONTROL)
+				{
+					service.control(event.value);
+				}
+			}
+
+			waitForStatus(service, status_seen);
+			if (starter.joinable())
+			{
+				starter.join();
+			}
+
+			service.disableTrace();
+			report.replayed = service.getTrace();
+			compare(recorded, report);
+
+			return report;
+		}
+	};
+}
+
+#endif /* SERVICE_TRACE_REPLAYER_HPP_ */
\ No newline at end of file
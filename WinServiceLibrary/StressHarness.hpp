@@ -0,0 +1,132 @@
+#ifndef STRESS_HARNESS_HPP_
+#define STRESS_HARNESS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinServiceLib
+{
+	/*
+	* Common part of the reports of the stress and check harnesses
+	*/
+	struct HarnessReport
+	{
+		unsigned long long			violations;		//Number of violated expectations
+		std::vector<std::string>	messages;		//Description of the first violations
+
+		/* Return whether all expectations held */
+		bool passed() const
+		{
+			return violations == 0;
+		}
+	};
+
+	/*
+	* Latency distribution of a measured operation, in microseconds
+	*/
+	struct LatencyPercentiles
+	{
+		double		p50;		//Median
+		double		p99;		//99th percentile
+		double		p999;		//99.9th percentile
+		double		max;		//Highest latency
+
+		/* Return the distribution of latency samples, sorts the samples */
+		static LatencyPercentiles of(std::vector<double>& samples)
+		{
+			LatencyPercentiles result = { 0.0, 0.0, 0.0, 0.0 };
+			if (samples.empty())
+			{
+				return result;
+			}
+
+			std::sort(samples.begin(), samples.end());
+			auto at = [&samples](double fraction)
+			{
+				size_t index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1) + 0.5);
+				return samples[std::min(index, samples.size() - 1)];
+			};
+
+			result.p50 = at(0.5);
+			result.p99 = at(0.99);
+			result.p999 = at(0.999);
+			result.max = samples.back();
+			return result;
+		}
+	};
+
+	/*
+	* Base of the stress and check harnesses - collects violated expectations from any thread
+	* and waits for asynchronous effects to settle.
+	*/
+	class StressHarness
+	{
+	private:
+		/* Maximum number of violation descriptions kept */
+		static const size_t MAX_MESSAGES = 16;
+
+		std::mutex						_violationLock;	//Guards _messages
+		std::atomic<unsigned long long>	_violations;	//Number of violated expectations
+		std::vector<std::string>		_messages;		//Description of the first violations
+
+	protected:
+		/* Maximum time to wait for an asynchronous effect, in milliseconds */
+		static const unsigned long SETTLE_TIMEOUT = 5000;
+
+		StressHarness()
+			: _violations(0)
+		{}
+
+		StressHarness(const StressHarness&) = delete;
+		StressHarness& operator=(const StressHarness&) = delete;
+
+		/* Record a violated expectation, safe to call from any thread */
+		void violation(const std::string& message)
+		{
+			++_violations;
+
+			std::lock_guard<std::mutex> guard(_violationLock);
+			if (_messages.size() < MAX_MESSAGES)
+			{
+				_messages.push_back(message);
+			}
+		}
+
+		/* Copy the collected violations into a report */
+		void collect(HarnessReport& report)
+		{
+			std::lock_guard<std::mutex> guard(_violationLock);
+			report.violations = _violations;
+			report.messages = _messages;
+		}
+
+		/*
+		* Method: settle
+		* Task: Wait until a condition holds, polling it every millisecond
+		* Args: condition - Returns true once the awaited effect happened
+		*		timeout - Maximum time to wait in milliseconds
+		* Return: false if the condition didn't hold in time
+		*/
+		template <typename Condition>
+		static bool settle(Condition condition, unsigned long timeout = SETTLE_TIMEOUT)
+		{
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+			while (!condition())
+			{
+				if (std::chrono::steady_clock::now() >= deadline)
+				{
+					return false;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			return true;
+		}
+	};
+}
+
+#endif /* STRESS_HARNESS_HPP_ */
\ No newline at end of file